@@ -13,7 +13,23 @@ CONFIG   += DWM_API
 SOURCES += \
     main.cpp \
     settings.cpp \
+    colorfilter.cpp \
     document.cpp \
+    textlayer.cpp \
+    renderservice.cpp \
+    pageprefetcher.cpp \
+    pagecache.cpp \
+    textnormalizer.cpp \
+    textindex.cpp \
+    searchjob.cpp \
+    searchquery.cpp \
+    searchresultsmodel.cpp \
+    searchsession.cpp \
+    exportjob.cpp \
+    notesfile.cpp \
+    notesstore.cpp \
+    fuzzymatcher.cpp \
+    glyphindex.cpp \
     selectionlabel.cpp \
     viewerwidget.cpp \
     favoritesdialog.cpp \
@@ -31,7 +47,23 @@ SOURCES += \
 # ----------------------------------------------------
 HEADERS += \
     settings.h \
+    colorfilter.h \
     document.h \
+    textlayer.h \
+    renderservice.h \
+    pageprefetcher.h \
+    pagecache.h \
+    textnormalizer.h \
+    textindex.h \
+    searchjob.h \
+    searchquery.h \
+    searchresultsmodel.h \
+    searchsession.h \
+    exportjob.h \
+    notesfile.h \
+    notesstore.h \
+    fuzzymatcher.h \
+    glyphindex.h \
     selectionlabel.h \
     viewerwidget.h \
     favoritesdialog.h \
@@ -0,0 +1,110 @@
+#include "colorfilter.h"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COLORFILTER_SSE2
+#endif
+
+// Per channel: out = ink + in * (paper - ink) / 255, evaluated as
+// ink + ((in << 7) * k) >> 16 with k = (paper - ink) * 512 / 255, so both the SSE2
+// path (pmulhw) and the scalar path stay within 16-bit lanes. k is rounded up so
+// the floor in the high-half multiply still lands exactly on the paper colour.
+// Alpha uses k = 512 and no offset, which passes it through unchanged.
+struct ChannelCoefficients
+{
+    qint16 scale[4];
+    qint16 offset[4];
+};
+
+static qint16 channelScale(int paper, int ink)
+{
+    return qint16(std::ceil((paper - ink) * 512.0 / 255.0));
+}
+
+static ChannelCoefficients coefficientsFor(const QColor& paper, const QColor& ink)
+{
+    // Lanes follow the QRgb value from its low byte up: B, G, R, A.
+    return {
+        { channelScale(paper.blue(), ink.blue()), channelScale(paper.green(), ink.green()),
+          channelScale(paper.red(), ink.red()), 512 },
+        { qint16(ink.blue()), qint16(ink.green()), qint16(ink.red()), 0 }
+    };
+}
+
+static inline quint32 filterPixel(quint32 pixel, const ChannelCoefficients& c)
+{
+    quint32 out = 0;
+    for (int lane = 0; lane < 4; ++lane) {
+        const int in = (pixel >> (8 * lane)) & 0xff;
+        const int value = c.offset[lane] + (((in << 7) * c.scale[lane]) >> 16);
+        out |= quint32(qBound(0, value, 255)) << (8 * lane);
+    }
+    return out;
+}
+
+static void filterRow(quint32* row, int width, const ChannelCoefficients& c)
+{
+    int x = 0;
+#ifdef COLORFILTER_SSE2
+    const __m128i scale = _mm_setr_epi16(c.scale[0], c.scale[1], c.scale[2], c.scale[3],
+                                         c.scale[0], c.scale[1], c.scale[2], c.scale[3]);
+    const __m128i offset = _mm_setr_epi16(c.offset[0], c.offset[1], c.offset[2], c.offset[3],
+                                          c.offset[0], c.offset[1], c.offset[2], c.offset[3]);
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 4 <= width; x += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        __m128i lo = _mm_unpacklo_epi8(pixels, zero);
+        __m128i hi = _mm_unpackhi_epi8(pixels, zero);
+        lo = _mm_add_epi16(offset, _mm_mulhi_epi16(_mm_slli_epi16(lo, 7), scale));
+        hi = _mm_add_epi16(offset, _mm_mulhi_epi16(_mm_slli_epi16(hi, 7), scale));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; x < width; ++x) {
+        row[x] = filterPixel(row[x], c);
+    }
+}
+
+ColorFilter ColorFilter::forMode(ColorMode mode, const QColor& customPaper, const QColor& customInk)
+{
+    ColorFilter filter;
+    filter.mode = mode;
+    switch (mode) {
+    case ColorMode::Normal:
+        break;
+    case ColorMode::Invert:
+        filter.paperColor = Qt::black;
+        filter.inkColor = Qt::white;
+        break;
+    case ColorMode::Sepia:
+        filter.paperColor = QColor(244, 236, 216);
+        filter.inkColor = QColor(91, 70, 54);
+        break;
+    case ColorMode::Custom:
+        filter.paperColor = customPaper;
+        filter.inkColor = customInk;
+        break;
+    }
+    return filter;
+}
+
+bool ColorFilter::isIdentity() const
+{
+    return paperColor == QColor(Qt::white) && inkColor == QColor(Qt::black);
+}
+
+QImage ColorFilter::apply(const QImage& image) const
+{
+    if (image.isNull() || isIdentity()) return image;
+
+    // Rendered pages are opaque, so treating the premultiplied samples as plain
+    // colour is exact. scanLine() detaches, leaving the cached render untouched.
+    QImage result = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    const ChannelCoefficients coefficients = coefficientsFor(paperColor, inkColor);
+    for (int y = 0; y < result.height(); ++y) {
+        filterRow(reinterpret_cast<quint32*>(result.scanLine(y)), result.width(), coefficients);
+    }
+    return result;
+}
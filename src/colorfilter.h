@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QImage>
+#include <QColor>
+
+enum class ColorMode { Normal, Invert, Sepia, Custom };
+
+// Recolours rendered pages at display time. Every mode maps each channel linearly
+// from ink (black) to paper (white), so one cached render serves all of them and
+// switching modes never goes back to MuPDF.
+struct ColorFilter
+{
+    ColorMode mode = ColorMode::Normal;
+    QColor paperColor = Qt::white;
+    QColor inkColor = Qt::black;
+
+    static ColorFilter forMode(ColorMode mode, const QColor& customPaper, const QColor& customInk);
+
+    bool isIdentity() const;
+    QImage apply(const QImage& image) const;
+
+    bool operator==(const ColorFilter& other) const
+    {
+        return mode == other.mode && paperColor == other.paperColor && inkColor == other.inkColor;
+    }
+    bool operator!=(const ColorFilter& other) const { return !(*this == other); }
+};
@@ -2,6 +2,41 @@
 #include <algorithm>
 #include <QDebug>
 #include <QPainter>
+#include <atomic>
+
+static const int DisplayListCacheSize = 12;
+static const int TextLayerCacheSize = 32;
+
+// MuPDF's BGRA with premultiplied alpha is byte-for-byte QImage's ARGB32_Premultiplied
+// on little-endian machines, so pages can be painted without any conversion.
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+static const QImage::Format PageImageFormat = QImage::Format_ARGB32_Premultiplied;
+#else
+static const QImage::Format PageImageFormat = QImage::Format_RGBA8888_Premultiplied;
+#endif
+
+static fz_colorspace* pageColorspace(fz_context* ctx)
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    return fz_device_bgr(ctx);
+#else
+    return fz_device_rgb(ctx);
+#endif
+}
+
+struct PixmapHandle {
+    fz_context* ctx;
+    fz_pixmap* pixmap;
+};
+
+// Dropping a pixmap only takes MuPDF's allocator lock, so this is safe from
+// whichever thread releases the last QImage reference.
+static void releasePixmap(void* info)
+{
+    PixmapHandle* handle = static_cast<PixmapHandle*>(info);
+    fz_drop_pixmap(handle->ctx, handle->pixmap);
+    delete handle;
+}
 
 void traverseOutline(fz_context* ctx, fz_document* doc, fz_outline* outline, QVector<TocItem>& items)
 {
@@ -25,20 +60,28 @@ void traverseOutline(fz_context* ctx, fz_document* doc, fz_outline* outline, QVe
     }
 }
 
+static std::atomic<quint32> s_nextDocumentId{1};
+
 Document::Document(fz_context* ctx, const QString& filepath)
     : m_ctx(ctx),
     m_doc(nullptr),
+    m_id(s_nextDocumentId++),
     m_filepath(filepath),
     m_currentPage(0),
     m_pageCount(0)
 {
+    m_textLayers.setMaxCost(TextLayerCacheSize);
 }
 
 Document::~Document() {
+    for (fz_display_list* list : std::as_const(m_displayLists)) {
+        fz_drop_display_list(m_ctx, list);
+    }
     if (m_doc) fz_drop_document(m_ctx, m_doc);
 }
 
 bool Document::load() {
+    if (m_doc) return true;
     if (!m_ctx || m_filepath.isEmpty()) return false;
     fz_try(m_ctx) {
         m_doc = fz_open_document(m_ctx, m_filepath.toStdString().c_str());
@@ -47,73 +90,139 @@ bool Document::load() {
         qWarning() << "Failed to load document:" << fz_caught_message(m_ctx);
         return false;
     }
+    m_currentPage = std::clamp(m_currentPage, 0, std::max(0, m_pageCount - 1));
     return true;
 }
 
-QImage Document::renderCurrentPage(qreal zoomFactor, bool invertColors) {
-    if (!m_doc || m_currentPage < 0 || m_currentPage >= m_pageCount) return QImage();
-    QImage renderedImage;
+bool Document::isLoaded() const {
+    return m_doc != nullptr;
+}
+
+fz_display_list* Document::loadDisplayList(fz_context* ctx, int pageNum) const
+{
+    if (!m_doc || pageNum < 0 || pageNum >= m_pageCount) return nullptr;
+
+    QMutexLocker locker(&m_mutex);
+    if (fz_display_list* cached = m_displayLists.value(pageNum)) {
+        m_displayListOrder.removeOne(pageNum);
+        m_displayListOrder.append(pageNum);
+        return fz_keep_display_list(ctx, cached);
+    }
+
     fz_page* page = nullptr;
+    fz_display_list* list = nullptr;
+
+    fz_try(ctx) {
+        page = fz_load_page(ctx, m_doc, pageNum);
+        list = fz_new_display_list_from_page(ctx, page);
+    } fz_catch(ctx) {
+        qWarning() << "Failed to load page" << pageNum << ":" << fz_caught_message(ctx);
+        list = nullptr;
+    }
+
+    if (page) fz_drop_page(ctx, page);
+
+    if (list) {
+        m_displayLists.insert(pageNum, fz_keep_display_list(ctx, list));
+        m_displayListOrder.append(pageNum);
+        while (m_displayListOrder.size() > DisplayListCacheSize) {
+            fz_drop_display_list(ctx, m_displayLists.take(m_displayListOrder.takeFirst()));
+        }
+    }
+    return list;
+}
+
+QImage Document::renderDisplayList(fz_context* ctx, fz_display_list* list, qreal zoomFactor, const QRect& clip, fz_cookie* cookie) const
+{
+    if (!list) return QImage();
+    QImage renderedImage;
     fz_pixmap* pixmap = nullptr;
-    fz_try(m_ctx) {
-        page = fz_load_page(m_ctx, m_doc, m_currentPage);
+    fz_device* device = nullptr;
+    fz_try(ctx) {
         fz_matrix ctm = fz_scale(zoomFactor, zoomFactor);
-        pixmap = fz_new_pixmap_from_page(m_ctx, page, ctm, fz_device_rgb(m_ctx), 0);
-        if (invertColors) {
-            fz_try(m_ctx) {
-                fz_invert_pixmap(m_ctx, pixmap);
-            } fz_catch(m_ctx) {
-                qWarning() << "Failed to invert pixmap colors";
-            }
+        fz_irect bbox = fz_round_rect(fz_transform_rect(fz_bound_display_list(ctx, list), ctm));
+        if (!clip.isNull()) {
+            fz_irect tile = fz_make_irect(bbox.x0 + clip.left(), bbox.y0 + clip.top(),
+                                          bbox.x0 + clip.left() + clip.width(), bbox.y0 + clip.top() + clip.height());
+            bbox = fz_intersect_irect(bbox, tile);
         }
-        renderedImage = QImage(pixmap->samples, pixmap->w, pixmap->h, pixmap->stride, QImage::Format_RGB888).copy();
-    } fz_catch(m_ctx) {
-        qWarning() << "Error rendering page" << m_currentPage << ":" << fz_caught_message(m_ctx);
+        pixmap = fz_new_pixmap_with_bbox(ctx, pageColorspace(ctx), bbox, nullptr, 1);
+        fz_clear_pixmap_with_value(ctx, pixmap, 0xff);
+        device = fz_new_draw_device(ctx, fz_identity, pixmap);
+        fz_run_display_list(ctx, list, device, ctm, fz_rect_from_irect(bbox), cookie);
+        fz_close_device(ctx, device);
+        if (!cookie || !cookie->abort) {
+            renderedImage = QImage(pixmap->samples, pixmap->w, pixmap->h, pixmap->stride, PageImageFormat,
+                                   releasePixmap, new PixmapHandle{ m_ctx, pixmap });
+            pixmap = nullptr;
+        }
+    } fz_catch(ctx) {
+        qWarning() << "Error rendering page:" << fz_caught_message(ctx);
         renderedImage = QImage();
     }
-    if (pixmap) fz_drop_pixmap(m_ctx, pixmap);
-    if (page) fz_drop_page(m_ctx, page);
+    if (device) fz_drop_device(ctx, device);
+    if (pixmap) fz_drop_pixmap(ctx, pixmap);
     return renderedImage;
 }
 
-QVector<QRectF> Document::getPageCharRects(int pageNum, qreal zoomFactor) const
+QSharedPointer<const TextLayer> Document::getTextLayer(int pageNum) const
 {
-    QVector<QRectF> allRects;
-    if (!m_doc || pageNum < 0 || pageNum >= m_pageCount) return allRects;
+    return getTextLayer(m_ctx, pageNum);
+}
+
+QSharedPointer<const TextLayer> Document::getTextLayer(fz_context* ctx, int pageNum) const
+{
+    if (QSharedPointer<const TextLayer> cached = cachedTextLayer(pageNum)) return cached;
+    if (!m_doc || pageNum < 0 || pageNum >= m_pageCount) return QSharedPointer<const TextLayer>();
+
+    QMutexLocker locker(&m_mutex);
 
+    // Replay the display list if the page was rendered recently; otherwise read the
+    // page directly so a document-wide walk doesn't flush the display-list LRU.
+    fz_display_list* list = m_displayLists.value(pageNum);
     fz_page* page = nullptr;
     fz_stext_page* stext_page = nullptr;
 
-    fz_try(m_ctx) {
-        page = fz_load_page(m_ctx, m_doc, pageNum);
-        stext_page = fz_new_stext_page_from_page(m_ctx, page, NULL);
-        fz_matrix ctm = fz_scale(zoomFactor, zoomFactor);
-
-        for (fz_stext_block* block = stext_page->first_block; block; block = block->next) {
-            if (block->type == FZ_STEXT_BLOCK_TEXT) {
-                for (fz_stext_line* line = block->u.t.first_line; line; line = line->next) {
-                    for (fz_stext_char* ch = line->first_char; ch; ch = ch->next) {
-                        fz_rect char_rect = fz_rect_from_quad(ch->quad);
-                        char_rect = fz_transform_rect(char_rect, ctm);
-                        allRects.append(QRectF(char_rect.x0, char_rect.y0, char_rect.x1 - char_rect.x0, char_rect.y1 - char_rect.y0));
-                    }
-                }
-            }
+    fz_try(ctx) {
+        if (list) {
+            stext_page = fz_new_stext_page_from_display_list(ctx, list, nullptr);
+        } else {
+            page = fz_load_page(ctx, m_doc, pageNum);
+            stext_page = fz_new_stext_page_from_page(ctx, page, nullptr);
         }
-    } fz_catch(m_ctx) {
-        qWarning() << "Failed to extract char rects:" << fz_caught_message(m_ctx);
+    } fz_catch(ctx) {
+        qWarning() << "Failed to extract text of page" << pageNum << ":" << fz_caught_message(ctx);
     }
 
-    if (stext_page) fz_drop_stext_page(m_ctx, stext_page);
-    if (page) fz_drop_page(m_ctx, page);
+    QSharedPointer<const TextLayer> layer;
+    if (stext_page) {
+        layer = TextLayer::fromStextPage(stext_page);
+        fz_drop_stext_page(ctx, stext_page);
+        QMutexLocker cacheLocker(&m_textLayerMutex);
+        m_textLayers.insert(pageNum, new QSharedPointer<const TextLayer>(layer));
+    }
+    if (page) fz_drop_page(ctx, page);
+    return layer;
+}
 
-    return allRects;
+QSharedPointer<const TextLayer> Document::cachedTextLayer(int pageNum) const
+{
+    QMutexLocker locker(&m_textLayerMutex);
+    if (QSharedPointer<const TextLayer>* cached = m_textLayers.object(pageNum)) {
+        return *cached;
+    }
+    return QSharedPointer<const TextLayer>();
 }
 
 QSizeF Document::getOriginalPageSize(int pageNum) const
 {
     if (!m_doc || pageNum < 0 || pageNum >= m_pageCount) return QSizeF();
 
+    QMutexLocker locker(&m_mutex);
+    if (auto it = m_pageSizes.constFind(pageNum); it != m_pageSizes.constEnd()) {
+        return it.value();
+    }
+
     fz_page* page = nullptr;
     QSizeF size;
 
@@ -121,6 +230,7 @@ QSizeF Document::getOriginalPageSize(int pageNum) const
         page = fz_load_page(m_ctx, m_doc, pageNum);
         fz_rect bounds = fz_bound_page(m_ctx, page);
         size = QSizeF(bounds.x1 - bounds.x0, bounds.y1 - bounds.y0);
+        m_pageSizes.insert(pageNum, size);
     } fz_catch(m_ctx) {
         qWarning() << "Failed to get page bounds:" << fz_caught_message(m_ctx);
     }
@@ -129,51 +239,10 @@ QSizeF Document::getOriginalPageSize(int pageNum) const
     return size;
 }
 
-QString Document::getSelectedText(const QRectF& selectionRect, qreal zoomFactor) const
+QString Document::getSelectedText(int firstGlyph, int lastGlyph) const
 {
-    if (!m_doc || m_currentPage < 0 || m_currentPage >= m_pageCount) return QString();
-
-    QString selectedTextStr;
-    fz_page* page = nullptr;
-    fz_stext_page* stext_page = nullptr;
-    char* text = nullptr;
-
-    fz_try(m_ctx)
-    {
-        page = fz_load_page(m_ctx, m_doc, m_currentPage);
-        stext_page = fz_new_stext_page_from_page(m_ctx, page, nullptr);
-
-        fz_matrix scale_matrix = fz_scale(zoomFactor, zoomFactor);
-        fz_matrix inverse_matrix = fz_invert_matrix(scale_matrix);
-
-        fz_point p0 = { (float)selectionRect.left(), (float)selectionRect.top() };
-        fz_point p1 = { (float)selectionRect.right(), (float)selectionRect.bottom() };
-
-        p0 = fz_transform_point(p0, inverse_matrix);
-        p1 = fz_transform_point(p1, inverse_matrix);
-
-        float x0 = std::min(p0.x, p1.x);
-        float y0 = std::min(p0.y, p1.y);
-        float x1 = std::max(p0.x, p1.x);
-        float y1 = std::max(p0.y, p1.y);
-
-        fz_point a = { x0, y0 };
-        fz_point b = { x1, y1 };
-
-        text = fz_copy_selection(m_ctx, stext_page, a, b, 0);
-        selectedTextStr = QString::fromUtf8(text);
-    }
-    fz_catch(m_ctx)
-    {
-        qWarning() << "Failed to get selected text:" << fz_caught_message(m_ctx);
-        selectedTextStr = QString();
-    }
-
-    if (text) fz_free(m_ctx, text);
-    if (stext_page) fz_drop_stext_page(m_ctx, stext_page);
-    if (page) fz_drop_page(m_ctx, page);
-
-    return selectedTextStr;
+    QSharedPointer<const TextLayer> layer = getTextLayer(m_currentPage);
+    return layer ? layer->text(firstGlyph, lastGlyph) : QString();
 }
 
 void Document::goToNextPage() {
@@ -185,71 +254,12 @@ void Document::goToPrevPage() {
 }
 
 void Document::goToPage(int page) {
-    if (page >= 0 && page < m_pageCount) m_currentPage = page;
-}
-
-QVector<SearchResult> Document::searchDocument(const QString& text) const
-{
-    QVector<SearchResult> allResults;
-    if (!m_doc || text.isEmpty()) return allResults;
-
-    const QString searchTerm = text.simplified();
-    if (searchTerm.isEmpty()) return allResults;
-
-    for (int i = 0; i < m_pageCount; ++i) {
-        fz_page* page = nullptr;
-        fz_stext_page* stext_page = nullptr;
-        fz_try(m_ctx) {
-            page = fz_load_page(m_ctx, m_doc, i);
-            stext_page = fz_new_stext_page_from_page(m_ctx, page, nullptr);
-            if (!stext_page) continue;
-
-            QString pageText;
-            QVector<fz_rect> charRects;
-
-            for (fz_stext_block* block = stext_page->first_block; block; block = block->next) {
-                if (block->type != FZ_STEXT_BLOCK_TEXT) continue;
-                for (fz_stext_line* line = block->u.t.first_line; line; line = line->next) {
-                    for (fz_stext_char* ch = line->first_char; ch; ch = ch->next) {
-                        pageText.append(QChar(ch->c));
-                        charRects.append(fz_rect_from_quad(ch->quad));
-                    }
-                    pageText.append(' ');
-                    charRects.append(fz_empty_rect);
-                }
-            }
-
-            int from = 0;
-            while ((from = pageText.indexOf(searchTerm, from, Qt::CaseInsensitive)) != -1) {
-                int matchEnd = from + searchTerm.length();
-
-                fz_rect combined_rect = fz_empty_rect;
-                for (int j = from; j < matchEnd; ++j) {
-                    if (!fz_is_empty_rect(charRects[j])) {
-                        combined_rect = fz_is_empty_rect(combined_rect) ? charRects[j] : fz_union_rect(combined_rect, charRects[j]);
-                    }
-                }
-
-                if (!fz_is_empty_rect(combined_rect)) {
-                    int contextStart = std::max(0, from - 20);
-                    int contextEnd = std::min((int)pageText.length(), matchEnd + 20);
-                    QString context = pageText.mid(contextStart, contextEnd - contextStart).replace('\n', ' ').simplified();
-
-                    SearchResult result;
-                    result.pageNum = i;
-                    result.context = "..." + context + "...";
-                    result.location = QRectF(combined_rect.x0, combined_rect.y0, combined_rect.x1 - combined_rect.x0, combined_rect.y1 - combined_rect.y0);
-                    allResults.append(result);
-                }
-                from = matchEnd;
-            }
-        } fz_catch(m_ctx) {
-        }
-        if (stext_page) fz_drop_stext_page(m_ctx, stext_page);
-        if (page) fz_drop_page(m_ctx, page);
+    if (!m_doc) {
+        // Remembered until load(), which clamps it to the real page count.
+        m_currentPage = std::max(0, page);
+    } else if (page >= 0 && page < m_pageCount) {
+        m_currentPage = page;
     }
-
-    return allResults;
 }
 
 QVector<TocItem> Document::getTableOfContents() const
@@ -257,6 +267,7 @@ QVector<TocItem> Document::getTableOfContents() const
     QVector<TocItem> toc;
     if (!m_doc) return toc;
 
+    QMutexLocker locker(&m_mutex);
     fz_outline *outline = nullptr;
     fz_try(m_ctx) {
         outline = fz_load_outline(m_ctx, m_doc);
@@ -277,3 +288,4 @@ QVector<TocItem> Document::getTableOfContents() const
 int Document::getCurrentPage() const { return m_currentPage; }
 int Document::getPageCount() const { return m_pageCount; }
 QString Document::getFilepath() const { return m_filepath; }
+quint32 Document::getId() const { return m_id; }
@@ -6,11 +6,25 @@
 #include <QImage>
 #include <QSize>
 #include <QRectF>
+#include <QRect>
+#include <QHash>
+#include <QList>
+#include <QCache>
+#include <QSharedPointer>
 #include <QVector>
+#include <QMutex>
+#include "textlayer.h"
 
+// textStart and textEnd locate the hit in the page text PageText::fromTextLayer()
+// builds. context is the hit with a few characters either side, cut from that text
+// by the search itself, so showing a result never has to extract the page again.
+// distance is the number of edits a fuzzy search needed to match it.
 struct SearchResult {
     int pageNum;
     QRectF location;
+    int textStart;
+    int textEnd;
+    int distance;
     QString context;
 };
 Q_DECLARE_METATYPE(SearchResult)
@@ -30,24 +44,54 @@ public:
     Document(Document&&) = delete;
     Document& operator=(Document&&) =delete;
 
+    // Opens the fz_document. Until then the Document is a placeholder that only
+    // knows its path and the page to open at, which is how restored tabs start out.
     bool load();
-    QImage renderCurrentPage(qreal zoomFactor, bool invertColors);
+    bool isLoaded() const;
     void goToNextPage();
     void goToPrevPage();
     void goToPage(int page);
     int getCurrentPage() const;
     int getPageCount() const;
     QString getFilepath() const;
+    quint32 getId() const;
 
-    QString getSelectedText(const QRectF& selectionRect, qreal zoomFactor) const;
-    QVector<QRectF> getPageCharRects(int pageNum, qreal zoomFactor) const;
-    QVector<SearchResult> searchDocument(const QString& text) const;
+    // Text of the current page's glyphs firstGlyph..lastGlyph, as indexed by its
+    // text layer.
+    QString getSelectedText(int firstGlyph, int lastGlyph) const;
     QSizeF getOriginalPageSize(int pageNum) const;
     QVector<TocItem> getTableOfContents() const;
 
+    // Text layers of recently used pages are kept in an LRU, so selecting, copying
+    // and saving a passage extract the page text once between them.
+    QSharedPointer<const TextLayer> getTextLayer(int pageNum) const;
+    QSharedPointer<const TextLayer> getTextLayer(fz_context* ctx, int pageNum) const;
+    // Only what is in that LRU; null rather than extracting, so the GUI thread can
+    // ask without waiting on the document.
+    QSharedPointer<const TextLayer> cachedTextLayer(int pageNum) const;
+
+    // Thread-safe entry points for the render workers. Each worker passes its own
+    // cloned context; only building the display list touches the fz_document, and
+    // that part is serialised on m_mutex. Display lists of recently viewed pages are
+    // kept in a small LRU, so re-rendering at another zoom only replays the list.
+    // The caller owns a reference to the returned list.
+    fz_display_list* loadDisplayList(fz_context* ctx, int pageNum) const;
+    // A non-null clip (in zoomed device pixels, relative to the page origin) renders
+    // only that part of the page, which is how high-zoom tiles are produced. The
+    // returned image wraps the MuPDF samples directly in Qt's native 32-bit
+    // premultiplied layout and drops the pixmap when the last copy goes away.
+    QImage renderDisplayList(fz_context* ctx, fz_display_list* list, qreal zoomFactor, const QRect& clip, fz_cookie* cookie) const;
+
 private:
     fz_context* m_ctx;
     fz_document* m_doc;
+    quint32 m_id;
+    mutable QMutex m_mutex;
+    mutable QHash<int, QSizeF> m_pageSizes;
+    mutable QHash<int, fz_display_list*> m_displayLists;
+    mutable QList<int> m_displayListOrder;
+    mutable QMutex m_textLayerMutex;   // guards m_textLayers, which m_mutex doesn't
+    mutable QCache<int, QSharedPointer<const TextLayer>> m_textLayers;
     QString m_filepath;
     int m_currentPage;
     int m_pageCount;
@@ -0,0 +1,261 @@
+#include "exportjob.h"
+
+#include <QtConcurrent>
+#include <QThread>
+#include <QStringList>
+#include <QRegularExpression>
+#include <QDebug>
+#include <algorithm>
+
+// Pages extracted but not yet written, at most. Keeps every worker busy while the
+// writer catches up, without letting a fast pool run away from a slow disk.
+static const int MaxPagesAhead = 16;
+static const int MaxHeadingLevel = 6;
+
+static void collectHeadings(const QVector<TocItem>& items, int level, QHash<int, QVector<QPair<int, QString>>>& headings)
+{
+    for (const TocItem& item : items) {
+        const QString title = item.title.simplified();
+        if (!title.isEmpty()) headings[item.pageNum].append({ level, title });
+        collectHeadings(item.children, std::min(level + 1, MaxHeadingLevel), headings);
+    }
+}
+
+// A paragraph whose first characters Markdown would read as a heading, quote, list
+// item or rule gets them escaped.
+static QString escapeMarkdown(const QString& paragraph)
+{
+    static const QRegularExpression blockMarkup(QStringLiteral("^(#|>|[-+*=_]|\\d+[.)])"));
+    QString escaped = paragraph;
+    const QRegularExpressionMatch match = blockMarkup.match(escaped);
+    if (match.hasMatch()) escaped.insert(match.capturedEnd() - 1, QLatin1Char('\\'));
+    return escaped;
+}
+
+// The lines of a block as one paragraph, undoing hyphenation at line ends.
+static QString joinLines(const QString& block)
+{
+    QString paragraph;
+    for (const QString& line : block.split(QLatin1Char('\n'))) {
+        const QString trimmed = line.trimmed();
+        if (trimmed.isEmpty()) continue;
+        if (paragraph.isEmpty()) {
+            paragraph = trimmed;
+        } else if (paragraph.endsWith(QLatin1Char('-')) && paragraph.size() > 1 && paragraph[paragraph.size() - 2].isLetter()
+                   && trimmed[0].isLower()) {
+            paragraph.chop(1);
+            paragraph += trimmed;
+        } else {
+            paragraph += QLatin1Char(' ') + trimmed;
+        }
+    }
+    return paragraph;
+}
+
+ExportJob::ExportJob(fz_context* ctx, const QString& filepath, int pageCount, const QString& outputPath, Format format, QObject* parent)
+    : QObject(parent),
+    m_ctx(ctx),
+    m_filepath(filepath),
+    m_pageCount(pageCount),
+    m_format(format),
+    m_output(outputPath),
+    m_cancelled(false),
+    m_nextPage(0),
+    m_nextToWrite(0),
+    m_writing(false),
+    m_runningWorkers(0)
+{
+}
+
+ExportJob::~ExportJob()
+{
+    cancel();
+    // Workers borrow the base context through their clones.
+    m_pool.waitForDone();
+}
+
+void ExportJob::setTableOfContents(const QVector<TocItem>& toc)
+{
+    m_headings.clear();
+    collectHeadings(toc, 1, m_headings);
+}
+
+void ExportJob::start()
+{
+    if (!m_output.open(QIODevice::WriteOnly)) {
+        m_errorString = m_output.errorString();
+        QMetaObject::invokeMethod(this, &ExportJob::finish, Qt::QueuedConnection);
+        return;
+    }
+    if (m_pageCount <= 0) {
+        QMetaObject::invokeMethod(this, &ExportJob::finish, Qt::QueuedConnection);
+        return;
+    }
+
+    const int workerCount = std::clamp(QThread::idealThreadCount(), 1, std::min(m_pageCount, MaxPagesAhead));
+    m_runningWorkers = workerCount;
+    // Workers park while the writer catches up, so they get threads of their own
+    // rather than holding the global pool that notes compaction runs on.
+    m_pool.setMaxThreadCount(workerCount);
+    for (int i = 0; i < workerCount; ++i) {
+        QtConcurrent::run(&m_pool, [this] { workerLoop(); });
+    }
+}
+
+void ExportJob::cancel()
+{
+    QMutexLocker locker(&m_mutex);
+    m_cancelled = true;
+    m_pageWritten.wakeAll();
+}
+
+void ExportJob::fail(const QString& errorString)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_errorString.isEmpty()) m_errorString = errorString;
+    m_cancelled = true;
+    m_pageWritten.wakeAll();
+}
+
+void ExportJob::workerLoop()
+{
+    fz_context* ctx = fz_clone_context(m_ctx);
+    fz_document* doc = nullptr;
+    if (ctx) {
+        fz_try(ctx) {
+            doc = fz_open_document(ctx, m_filepath.toStdString().c_str());
+        } fz_catch(ctx) {
+            qWarning() << "Export worker failed to open document:" << fz_caught_message(ctx);
+        }
+    } else {
+        qWarning() << "Failed to clone MuPDF context for export worker";
+    }
+    if (!doc) fail(QStringLiteral("Could not open %1.").arg(m_filepath));
+
+    for (;;) {
+        int pageNum;
+        {
+            QMutexLocker locker(&m_mutex);
+            while (!m_cancelled && m_nextPage < m_pageCount && m_nextPage >= m_nextToWrite + MaxPagesAhead) {
+                m_pageWritten.wait(&m_mutex);
+            }
+            if (m_cancelled || m_nextPage >= m_pageCount) break;
+            pageNum = m_nextPage++;
+        }
+
+        // A page that can't be read is exported empty rather than failing the file.
+        QByteArray text;
+        fz_page* page = nullptr;
+        fz_stext_page* stext_page = nullptr;
+        fz_try(ctx) {
+            page = fz_load_page(ctx, doc, pageNum);
+            stext_page = fz_new_stext_page_from_page(ctx, page, nullptr);
+        } fz_catch(ctx) {
+            qWarning() << "Export failed to read page" << pageNum << ":" << fz_caught_message(ctx);
+        }
+        if (stext_page) {
+            text = formatPage(*TextLayer::fromStextPage(stext_page), pageNum, m_format, m_headings.value(pageNum));
+            fz_drop_stext_page(ctx, stext_page);
+        } else {
+            text = formatPage(TextLayer(), pageNum, m_format, m_headings.value(pageNum));
+        }
+        if (page) fz_drop_page(ctx, page);
+
+        pageDone(pageNum, text);
+    }
+
+    if (doc) fz_drop_document(ctx, doc);
+    if (ctx) fz_drop_context(ctx);
+
+    QMutexLocker locker(&m_mutex);
+    if (--m_runningWorkers == 0) {
+        QMetaObject::invokeMethod(this, &ExportJob::finish, Qt::QueuedConnection);
+    }
+}
+
+// Whichever worker brings the page the file is waiting for writes it, and every
+// page queued behind it, outside the lock; the others only queue theirs.
+void ExportJob::pageDone(int pageNum, const QByteArray& text)
+{
+    QMutexLocker locker(&m_mutex);
+    m_pending.insert(pageNum, text);
+    if (m_writing) return;
+
+    m_writing = true;
+    while (!m_cancelled && !m_pending.isEmpty() && m_pending.firstKey() == m_nextToWrite) {
+        const QByteArray chunk = m_pending.take(m_nextToWrite);
+        locker.unlock();
+        const bool written = m_output.write(chunk) == chunk.size();
+        locker.relock();
+        if (!written) {
+            if (m_errorString.isEmpty()) m_errorString = m_output.errorString();
+            m_cancelled = true;
+            break;
+        }
+
+        const int pagesWritten = ++m_nextToWrite;
+        m_pageWritten.wakeAll();
+        QMetaObject::invokeMethod(this, [this, pagesWritten] { emit progress(pagesWritten); }, Qt::QueuedConnection);
+    }
+    m_writing = false;
+    m_pageWritten.wakeAll();
+}
+
+void ExportJob::finish()
+{
+    QString errorString;
+    bool complete;
+    {
+        QMutexLocker locker(&m_mutex);
+        errorString = m_errorString;
+        complete = !m_cancelled && m_nextToWrite == m_pageCount;
+    }
+
+    if (complete && m_output.commit()) {
+        emit finished(true, QString());
+        return;
+    }
+    if (complete) {
+        errorString = m_output.errorString();
+    }
+    m_output.cancelWriting();
+    emit finished(false, errorString);
+}
+
+QByteArray ExportJob::formatPage(const TextLayer& layer, int pageNum, Format format, const QVector<QPair<int, QString>>& headings)
+{
+    QStringList blocks;
+    for (int b = 0; b < layer.blockStarts.size(); ++b) {
+        const int firstLine = layer.blockStarts[b];
+        const int endLine = b + 1 < layer.blockStarts.size() ? layer.blockStarts[b + 1] : layer.lineCount();
+        if (firstLine >= endLine) continue;
+        const int firstGlyph = layer.lineStarts[firstLine];
+        const int lastGlyph = layer.lineEnd(endLine - 1) - 1;
+        if (firstGlyph > lastGlyph) continue;
+
+        const QString block = layer.text(firstGlyph, lastGlyph);
+        if (format == Markdown) {
+            const QString paragraph = joinLines(block);
+            if (!paragraph.isEmpty()) blocks.append(escapeMarkdown(paragraph));
+        } else if (!block.trimmed().isEmpty()) {
+            blocks.append(block);
+        }
+    }
+
+    QString page;
+    if (format == Markdown) {
+        // Page markers are invisible when rendered, but let indexers map text back to pages.
+        page += QStringLiteral("<!-- page %1 -->\n\n").arg(pageNum + 1);
+        for (const QPair<int, QString>& heading : headings) {
+            page += QString(heading.first, QLatin1Char('#')) + QLatin1Char(' ') + heading.second + QStringLiteral("\n\n");
+        }
+        for (const QString& paragraph : std::as_const(blocks)) {
+            page += paragraph + QStringLiteral("\n\n");
+        }
+    } else {
+        page = blocks.join(QStringLiteral("\n\n"));
+        if (!page.isEmpty()) page += QLatin1Char('\n');
+        page += QLatin1Char('\f');
+    }
+    return page.toUtf8();
+}
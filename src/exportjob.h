@@ -0,0 +1,77 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QThreadPool>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSaveFile>
+#include <atomic>
+#include <mupdf/fitz.h>
+
+#include "document.h"
+#include "textlayer.h"
+
+// Writes the text of a whole document to a plain text or Markdown file. Pages are
+// extracted on the global thread pool, each worker with its own cloned context and
+// document handle, but they reach the file strictly in page order: no worker takes
+// a page more than MaxPagesAhead past the one the file is waiting for, so only a
+// handful of pages are ever held in memory however long the document is. The file
+// replaces any existing one only once the last page is written; a cancelled or
+// failed export leaves it untouched.
+class ExportJob : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Format { PlainText, Markdown };
+
+    ExportJob(fz_context* ctx, const QString& filepath, int pageCount, const QString& outputPath, Format format, QObject* parent = nullptr);
+    ~ExportJob();
+    ExportJob(const ExportJob&) = delete;
+    ExportJob& operator=(const ExportJob&) = delete;
+
+    // Markdown exports put the entries as headings at the top of their pages. Must
+    // be called before start().
+    void setTableOfContents(const QVector<TocItem>& toc);
+    void start();
+    void cancel();
+
+    // Plain text keeps the page's lines, with a blank line between text blocks and
+    // a form feed after the page. Markdown joins each block into one paragraph.
+    static QByteArray formatPage(const TextLayer& layer, int pageNum, Format format, const QVector<QPair<int, QString>>& headings = {});
+
+signals:
+    void progress(int pagesWritten);
+    // errorString is empty when the export was cancelled.
+    void finished(bool succeeded, const QString& errorString);
+
+private:
+    void workerLoop();
+    void pageDone(int pageNum, const QByteArray& text);
+    void fail(const QString& errorString);
+    void finish();
+
+    fz_context* m_ctx;
+    QString m_filepath;
+    int m_pageCount;
+    Format m_format;
+    QSaveFile m_output;
+    QHash<int, QVector<QPair<int, QString>>> m_headings;     // page -> (level, title)
+    std::atomic<bool> m_cancelled;
+
+    QMutex m_mutex;
+    QWaitCondition m_pageWritten;
+    int m_nextPage;
+    int m_nextToWrite;
+    QMap<int, QByteArray> m_pending;
+    bool m_writing;
+    int m_runningWorkers;
+    QString m_errorString;
+    QThreadPool m_pool;
+};
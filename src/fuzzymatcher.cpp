@@ -0,0 +1,172 @@
+#include "fuzzymatcher.h"
+#include "textnormalizer.h"
+
+#include <algorithm>
+#include <climits>
+
+static const int AsciiSize = 128;
+static const int MinPieceLength = 2;
+
+// One column step of one 64-row block (Myers 1999, in Hyyrö's formulation with
+// the horizontal delta carried between blocks). hin is the delta entering the
+// block's top row; the return value is the delta at highBit, which is the block's
+// last row for the carry and the pattern's last row for the final block.
+static inline int advanceBlock(quint64& pv, quint64& mv, quint64 eq, int hin, quint64 highBit)
+{
+    const quint64 hinNegative = hin < 0 ? 1 : 0;
+    const quint64 xv = eq | mv;
+    eq |= hinNegative;
+    const quint64 xh = (((eq & pv) + pv) ^ pv) | eq;
+    quint64 ph = mv | ~(xh | pv);
+    quint64 mh = pv & xh;
+
+    int hout = 0;
+    if (ph & highBit) {
+        hout = 1;
+    } else if (mh & highBit) {
+        hout = -1;
+    }
+
+    ph = (ph << 1) | (hin > 0 ? 1 : 0);
+    mh = (mh << 1) | hinNegative;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+    return hout;
+}
+
+FuzzyMatcher::FuzzyMatcher(QStringView pattern, int maxDistance)
+    : m_pattern(pattern.toString()),
+    m_maxDistance(std::clamp(maxDistance, 0, int(pattern.size()) / 3))
+{
+    const int length = m_pattern.size();
+    if (length == 0) return;
+
+    m_blocks = (length + 63) / 64;
+    m_lastBit = quint64(1) << ((length - 1) % 64);
+    m_asciiPeq.fill(0, AsciiSize * m_blocks);
+    m_noMatch.fill(0, m_blocks);
+    for (int i = 0; i < length; ++i) {
+        const char16_t c = m_pattern[i].unicode();
+        quint64* eq;
+        if (c < AsciiSize) {
+            eq = m_asciiPeq.data() + c * m_blocks;
+        } else {
+            QVector<quint64>& entry = m_peq[c];
+            if (entry.isEmpty()) entry.fill(0, m_blocks);
+            eq = entry.data();
+        }
+        eq[i / 64] |= quint64(1) << (i % 64);
+    }
+
+    const int pieceCount = m_maxDistance + 1;
+    if (length / pieceCount >= MinPieceLength) {
+        for (int p = 0; p < pieceCount; ++p) {
+            const int from = length * p / pieceCount;
+            const int to = length * (p + 1) / pieceCount;
+            m_pieces.append(m_pattern.mid(from, to - from));
+        }
+    }
+}
+
+bool FuzzyMatcher::isEmpty() const
+{
+    return m_pattern.isEmpty();
+}
+
+int FuzzyMatcher::maxDistance() const
+{
+    return m_maxDistance;
+}
+
+bool FuzzyMatcher::mayMatch(QStringView text) const
+{
+    if (m_pieces.isEmpty()) return true;
+    return std::any_of(m_pieces.cbegin(), m_pieces.cend(), [text](const QString& piece) {
+        return TextNormalizer::find(text, piece) >= 0;
+    });
+}
+
+const quint64* FuzzyMatcher::peqFor(char16_t c) const
+{
+    if (c < AsciiSize) return m_asciiPeq.constData() + c * m_blocks;
+    const auto it = m_peq.constFind(c);
+    return it != m_peq.cend() ? it->constData() : m_noMatch.constData();
+}
+
+QVector<FuzzyMatcher::Match> FuzzyMatcher::find(QStringView text) const
+{
+    QVector<Match> matches;
+    if (isEmpty()) return matches;
+
+    QVector<quint64> pv(m_blocks, ~quint64(0));
+    QVector<quint64> mv(m_blocks, 0);
+    int score = m_pattern.size();
+
+    // Ends with a low enough score come in runs around every occurrence; the
+    // lowest score of a run is the match.
+    qsizetype bestEnd = -1;
+    int bestScore = 0;
+    auto emitBest = [&] {
+        if (bestEnd < 0) return;
+        const Match match = { startOf(text, bestEnd), bestEnd, bestScore };
+        if (!matches.isEmpty() && match.start < matches.last().end) {
+            if (match.distance < matches.last().distance) matches.last() = match;
+        } else {
+            matches.append(match);
+        }
+        bestEnd = -1;
+    };
+
+    const quint64 topBit = quint64(1) << 63;
+    for (qsizetype j = 0; j < text.size(); ++j) {
+        const quint64* eq = peqFor(text[j].unicode());
+        int carry = 0;
+        for (int b = 0; b < m_blocks; ++b) {
+            carry = advanceBlock(pv[b], mv[b], eq[b], carry, b == m_blocks - 1 ? m_lastBit : topBit);
+        }
+        score += carry;
+
+        if (score <= m_maxDistance) {
+            if (bestEnd < 0 || score < bestScore) {
+                bestEnd = j + 1;
+                bestScore = score;
+            }
+        } else {
+            emitBest();
+        }
+    }
+    emitBest();
+    return matches;
+}
+
+// The matcher only reports where a match ends. The start is where aligning the
+// pattern backwards from there reaches the lowest distance with the fewest units.
+qsizetype FuzzyMatcher::startOf(QStringView text, qsizetype end) const
+{
+    const int length = m_pattern.size();
+    const int window = int(std::min<qsizetype>(end, length + m_maxDistance));
+
+    // row[l]: distance between the last i pattern units and the l units before end.
+    QVector<int> row(window + 1);
+    for (int l = 0; l <= window; ++l) row[l] = l;
+    for (int i = 1; i <= length; ++i) {
+        int diagonal = row[0];
+        row[0] = i;
+        const QChar p = m_pattern[length - i];
+        for (int l = 1; l <= window; ++l) {
+            const int above = row[l];
+            row[l] = std::min({ above + 1, row[l - 1] + 1, diagonal + (text[end - l] == p ? 0 : 1) });
+            diagonal = above;
+        }
+    }
+
+    int bestLength = length;
+    int best = INT_MAX;
+    for (int l = 0; l <= window; ++l) {
+        if (row[l] < best) {
+            best = row[l];
+            bestLength = l;
+        }
+    }
+    return end - bestLength;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QString>
+#include <QStringView>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+
+// Approximate substring search: finds where a pattern occurs in a text with at
+// most a given number of inserted, deleted or substituted units. It runs Myers'
+// bit-parallel algorithm, one 64-bit word per 64 pattern units, so a whole page
+// is scanned in one pass whatever the distance. Both sides are expected to be
+// normalised already (TextNormalizer), like every other search mode.
+class FuzzyMatcher
+{
+public:
+    struct Match {
+        qsizetype start;
+        qsizetype end;
+        int distance;
+    };
+
+    FuzzyMatcher() = default;
+    // The distance is capped at a third of the pattern length, as anything looser
+    // matches almost everywhere.
+    FuzzyMatcher(QStringView pattern, int maxDistance);
+
+    bool isEmpty() const;
+    int maxDistance() const;
+
+    // Cheap necessary condition: split into maxDistance + 1 pieces, one of them has
+    // to occur exactly in any approximate match.
+    bool mayMatch(QStringView text) const;
+
+    // The best match of every cluster of overlapping candidates, in text order.
+    QVector<Match> find(QStringView text) const;
+
+private:
+    const quint64* peqFor(char16_t c) const;
+    qsizetype startOf(QStringView text, qsizetype end) const;
+
+    QString m_pattern;
+    int m_maxDistance = 0;
+    int m_blocks = 0;
+    quint64 m_lastBit = 0;
+    QVector<quint64> m_asciiPeq;                 // 128 entries of m_blocks words
+    QHash<char16_t, QVector<quint64>> m_peq;     // everything else in the pattern
+    QVector<quint64> m_noMatch;
+    QStringList m_pieces;
+};
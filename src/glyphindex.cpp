@@ -0,0 +1,183 @@
+#include "glyphindex.h"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <numeric>
+
+static const int GlyphsPerBand = 2;
+
+static qreal squaredDistance(const QRectF& box, const QPointF& point)
+{
+    const qreal dx = std::max({ box.left() - point.x(), 0.0, point.x() - box.right() });
+    const qreal dy = std::max({ box.top() - point.y(), 0.0, point.y() - box.bottom() });
+    return dx * dx + dy * dy;
+}
+
+// Consecutive glyphs share a line while they overlap vertically by at least half
+// the smaller height and don't jump back to the left.
+static bool continuesLine(const QRectF& previous, const QRectF& next)
+{
+    const qreal overlap = std::min(previous.bottom(), next.bottom()) - std::max(previous.top(), next.top());
+    const qreal height = std::min(previous.height(), next.height());
+    return overlap >= height / 2 && next.center().x() >= previous.left() - height;
+}
+
+void GlyphBoxes::reserve(int size)
+{
+    x0.reserve(size);
+    y0.reserve(size);
+    x1.reserve(size);
+    y1.reserve(size);
+}
+
+void GlyphBoxes::append(const QRectF& rect)
+{
+    x0.append(float(rect.left()));
+    y0.append(float(rect.top()));
+    x1.append(float(rect.right()));
+    y1.append(float(rect.bottom()));
+}
+
+GlyphIndex::GlyphIndex(const GlyphBoxes& boxes)
+    : m_boxes(boxes)
+{
+    if (m_boxes.size() == 0) return;
+
+    QVector<qreal> heights;
+    heights.reserve(m_boxes.size());
+    QRectF pageBounds;
+    QRectF previous;
+    for (int i = 0; i < m_boxes.size(); ++i) {
+        const QRectF rect = m_boxes.rect(i);
+        heights.append(rect.height());
+        pageBounds = pageBounds.isNull() ? rect : pageBounds.united(rect);
+
+        if (i == 0 || !continuesLine(previous, rect)) {
+            m_lines.append({ rect, i, 0, 0, 0 });
+        }
+        Line& line = m_lines.last();
+        line.bounds = line.bounds.united(rect);
+        ++line.count;
+        previous = rect;
+    }
+
+    m_byX.resize(m_boxes.size());
+    m_centerX.resize(m_boxes.size());
+    for (const Line& line : std::as_const(m_lines)) {
+        const auto begin = m_byX.begin() + line.first;
+        std::iota(begin, begin + line.count, line.first);
+        std::sort(begin, begin + line.count, [this](int a, int b) {
+            return m_boxes.x0[a] + m_boxes.x1[a] < m_boxes.x0[b] + m_boxes.x1[b];
+        });
+        for (int i = line.first; i < line.first + line.count; ++i) {
+            m_centerX[i] = (m_boxes.x0[m_byX[i]] + m_boxes.x1[m_byX[i]]) / 2;
+        }
+    }
+
+    std::nth_element(heights.begin(), heights.begin() + heights.size() / 2, heights.end());
+    m_bandHeight = std::max<qreal>(1, heights[heights.size() / 2] * GlyphsPerBand);
+    m_top = pageBounds.top();
+    m_bands.resize(int(pageBounds.height() / m_bandHeight) + 1);
+    for (int l = 0; l < m_lines.size(); ++l) {
+        Line& line = m_lines[l];
+        line.firstBand = std::clamp(int((line.bounds.top() - m_top) / m_bandHeight), 0, int(m_bands.size()) - 1);
+        line.lastBand = std::clamp(int((line.bounds.bottom() - m_top) / m_bandHeight), 0, int(m_bands.size()) - 1);
+        for (int b = line.firstBand; b <= line.lastBand; ++b) {
+            m_bands[b].append(l);
+        }
+    }
+}
+
+bool GlyphIndex::isEmpty() const
+{
+    return m_boxes.size() == 0;
+}
+
+int GlyphIndex::nearestGlyph(const QPointF& point) const
+{
+    if (isEmpty()) return -1;
+
+    const int bandCount = m_bands.size();
+    const int home = std::clamp(int(std::floor((point.y() - m_top) / m_bandHeight)), 0, bandCount - 1);
+    int best = -1;
+    qreal bestDistance = std::numeric_limits<qreal>::max();
+
+    for (int r = 0; home - r >= 0 || home + r < bandCount; ++r) {
+        for (int b : { home - r, home + r }) {
+            if (b < 0 || b >= bandCount || (r == 0 && b != home)) continue;
+            for (int l : m_bands[b]) {
+                // A line spanning several bands is looked at from the one nearest home.
+                const Line& line = m_lines[l];
+                if (std::abs(std::clamp(home, line.firstBand, line.lastBand) - home) != r) continue;
+                if (squaredDistance(line.bounds, point) < bestDistance) {
+                    searchLine(line, point, best, bestDistance);
+                }
+            }
+        }
+
+        // Every line not looked at yet lies in a band further out than r.
+        const qreal below = m_top + (home + r + 1) * m_bandHeight - point.y();
+        const qreal above = point.y() - (m_top + (home - r) * m_bandHeight);
+        const qreal bound = std::max<qreal>(0, std::min(home + r + 1 < bandCount ? below : std::numeric_limits<qreal>::max(),
+                                                        home - r - 1 >= 0 ? above : std::numeric_limits<qreal>::max()));
+        if (best >= 0 && bestDistance <= bound * bound) break;
+    }
+    return best;
+}
+
+void GlyphIndex::searchLine(const Line& line, const QPointF& point, int& best, qreal& bestDistance) const
+{
+    const auto begin = m_centerX.cbegin() + line.first;
+    const auto end = begin + line.count;
+    const int pos = int(std::lower_bound(begin, end, float(point.x())) - m_centerX.cbegin());
+
+    // Glyphs of a line hardly overlap, so the closest one sits next to where the
+    // point falls in x order; walk outwards while glyphs can still be closer.
+    for (int i = pos; i < line.first + line.count; ++i) {
+        const QRectF rect = m_boxes.rect(m_byX[i]);
+        const qreal dx = std::max<qreal>(0, rect.left() - point.x());
+        if (dx * dx >= bestDistance && i > pos) break;
+        const qreal distance = squaredDistance(rect, point);
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = m_byX[i];
+        }
+    }
+    for (int i = pos - 1; i >= line.first; --i) {
+        const QRectF rect = m_boxes.rect(m_byX[i]);
+        const qreal dx = std::max<qreal>(0, point.x() - rect.right());
+        if (dx * dx >= bestDistance && i < pos - 1) break;
+        const qreal distance = squaredDistance(rect, point);
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = m_byX[i];
+        }
+    }
+}
+
+QVector<QRectF> GlyphIndex::spanRects(int first, int last) const
+{
+    QVector<QRectF> spans;
+    if (first < 0 || last >= m_boxes.size() || first > last) return spans;
+
+    auto line = std::upper_bound(m_lines.cbegin(), m_lines.cend(), first, [](int glyph, const Line& l) {
+        return glyph < l.first;
+    }) - 1;
+    for (; line != m_lines.cend() && line->first <= last; ++line) {
+        const int lineLast = line->first + line->count - 1;
+        const int from = std::max(first, line->first);
+        const int to = std::min(last, lineLast);
+        if (from == line->first && to == lineLast) {
+            spans.append(line->bounds);
+            continue;
+        }
+
+        QRectF span = m_boxes.rect(from);
+        for (int i = from + 1; i <= to; ++i) {
+            span = span.united(m_boxes.rect(i));
+        }
+        spans.append(span);
+    }
+    return spans;
+}
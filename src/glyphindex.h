@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QVector>
+#include <QRectF>
+#include <QPointF>
+
+// Glyph boxes in unscaled page space as four parallel float arrays: 16 bytes a
+// glyph instead of a QRectF's 32, and the same copy serves every zoom level.
+struct GlyphBoxes
+{
+    QVector<float> x0, y0, x1, y1;
+
+    int size() const { return x0.size(); }
+    void reserve(int size);
+    void append(const QRectF& rect);
+    QRectF rect(int glyph) const { return QRectF(QPointF(x0[glyph], y0[glyph]), QPointF(x1[glyph], y1[glyph])); }
+};
+
+// Answers "which glyph is at (or nearest to) this point" without scanning the
+// page. Glyphs are grouped into lines, lines are bucketed into horizontal bands,
+// and each line keeps its glyphs sorted by x. A query looks at the lines of the
+// point's band, widening band by band only while a closer line could still exist,
+// and binary-searches the x order of the lines it looks at. Queries don't modify
+// the index, so a page's index can be shared between threads.
+class GlyphIndex
+{
+public:
+    GlyphIndex() = default;
+    explicit GlyphIndex(const GlyphBoxes& boxes);
+
+    bool isEmpty() const;
+
+    // The glyph whose box contains the point, or else the glyph whose box is
+    // closest to it; -1 only when there are no glyphs.
+    int nearestGlyph(const QPointF& point) const;
+
+    // One rectangle per line covering the glyphs first..last of that line, which
+    // is how a selection is drawn. Lines wholly inside the range cost nothing.
+    QVector<QRectF> spanRects(int first, int last) const;
+
+private:
+    struct Line {
+        QRectF bounds;
+        int first;      // first glyph of the line, and its offset into m_byX
+        int count;
+        int firstBand;
+        int lastBand;
+    };
+
+    void searchLine(const Line& line, const QPointF& point, int& best, qreal& bestDistance) const;
+
+    GlyphBoxes m_boxes;
+    QVector<Line> m_lines;
+    QVector<int> m_byX;             // glyph indices, grouped by line, sorted by centre x
+    QVector<float> m_centerX;       // parallel to m_byX
+    QVector<QVector<int>> m_bands;  // line indices overlapping each band
+    qreal m_top = 0;
+    qreal m_bandHeight = 1;
+};
@@ -1,11 +1,16 @@
 #include "mainwindow.h"
 #include "viewerwidget.h"
+#include "searchjob.h"
 
 #include <QApplication>
 #include <QStatusBar>
 #include <QLabel>
 #include <stdexcept>
 #include <QThread>
+#include <QSpinBox>
+#include <QPushButton>
+#include <QSignalBlocker>
+#include <QtConcurrent>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent),
@@ -19,13 +24,19 @@ MainWindow::MainWindow(QWidget *parent)
     m_pageLabel(nullptr),
     m_zoomLabel(nullptr),
     m_searchDockWidget(nullptr),
-    m_searchResultsList(nullptr),
+    m_searchResultsView(nullptr),
+    m_searchResults(nullptr),
     m_searchInput(nullptr),
+    m_searchModeCombo(nullptr),
+    m_searchScopeCombo(nullptr),
+    m_fuzzyDistanceSpin(nullptr),
+    m_matchDiacriticsButton(nullptr),
     m_openAction(nullptr),
     m_copyAction(nullptr),
     m_searchAction(nullptr),
     m_goToPageAction(nullptr),
-    m_invertColorsAction(nullptr),
+    m_pageColorsMenu(nullptr),
+    m_colorModeGroup(nullptr),
     m_toggleStatusBarAction(nullptr),
     m_exitAction(nullptr),
     m_resizeStartGeometry(),
@@ -34,9 +45,17 @@ MainWindow::MainWindow(QWidget *parent)
     m_isResizing(false),
     m_resizeEdge(Qt::Edge(0)),
     m_isInitialShow(true),
-    m_mupdfContext(nullptr)
+    m_previousZoomFactor(0.0),
+    m_selectionFirstGlyph(-1),
+    m_selectionLastGlyph(-1),
+    m_mupdfContext(nullptr),
+    m_renderService(nullptr),
+    m_searchSession(nullptr),
+    m_searchDebounceTimer(nullptr),
+    m_exportJob(nullptr),
+    m_searchResultsStale(false)
 {
-    m_mupdfContext = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    m_mupdfContext = fz_new_context(nullptr, RenderService::lockContext(), FZ_STORE_DEFAULT);
     if (!m_mupdfContext) {
         throw std::runtime_error("Failed to create MuPDF context.");
     }
@@ -49,7 +68,8 @@ MainWindow::MainWindow(QWidget *parent)
         throw std::runtime_error("Failed to register MuPDF document handlers.");
     }
 
-    m_pageCache.setMaxCost(100 * 1024 * 1024); // Set cache limit to 100 MB
+    m_renderService = new RenderService(m_mupdfContext, this);
+    connect(m_renderService, &RenderService::pageRendered, this, &MainWindow::onPageRendered);
 
     setWindowFlags(Qt::FramelessWindowHint);
     setMouseTracking(true);
@@ -62,6 +82,24 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    // Workers must be gone before the documents and the context they borrow. A
+    // cancelled search doesn't wait for its workers, so this is where they are.
+    cancelSearch();
+    SearchJob::threadPool()->waitForDone();
+    delete m_exportJob;
+    m_exportJob = nullptr;
+    // Folds any journaled note edits into the notes files.
+    qDeleteAll(m_notesStores);
+    m_notesStores.clear();
+    delete m_renderService;
+    m_renderService = nullptr;
+
+    // Page images wrap MuPDF pixmaps, so every holder has to let go of them before
+    // the context is dropped.
+    m_pageCache.clear();
+    while (m_tabWidget->count() > 0) {
+        delete m_tabWidget->widget(0);
+    }
     qDeleteAll(m_documents);
     if (m_mupdfContext) {
         fz_drop_context(m_mupdfContext);
@@ -75,7 +113,20 @@ void MainWindow::loadAppSettings()
     move(m_settings.windowPosition);
     m_statusBar->setVisible(m_settings.isStatusBarVisible);
     m_toggleStatusBarAction->setChecked(m_settings.isStatusBarVisible);
-    m_invertColorsAction->setChecked(m_settings.invertPageColors);
+    applyPageColors();
+    {
+        const QSignalBlocker blocker(m_fuzzyDistanceSpin);
+        m_fuzzyDistanceSpin->setValue(m_settings.fuzzySearchDistance);
+    }
+    {
+        const QSignalBlocker blocker(m_matchDiacriticsButton);
+        m_matchDiacriticsButton->setChecked(m_settings.matchDiacritics);
+    }
+    m_pageCache.setMaxBytes(qint64(m_settings.pageCacheSizeMB) * 1024 * 1024);
+    // On the search pool, like every other index read and write.
+    QtConcurrent::run(SearchJob::threadPool(), [maxBytes = qint64(m_settings.textIndexSizeMB) * 1024 * 1024] {
+        TextIndex::prune(maxBytes);
+    });
     updateFavoritesMenu();
 
     if (m_settings.isMaximized) {
@@ -99,6 +150,8 @@ void MainWindow::updateStatusBar()
 void MainWindow::clearSelectionState()
 {
     m_lastSelectionRect = QRect();
+    m_selectionFirstGlyph = -1;
+    m_selectionLastGlyph = -1;
     m_copyAction->setEnabled(false);
     int index = m_tabWidget->currentIndex();
     if (index >= 0) {
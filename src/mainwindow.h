@@ -6,11 +6,15 @@
 #include <QTimer>
 #include <QDockWidget>
 #include <QListWidget>
-#include <QCache>
 #include <QImage>
+#include <QHash>
 
 #include "settings.h"
 #include "document.h"
+#include "renderservice.h"
+#include "pageprefetcher.h"
+#include "pagecache.h"
+#include "notesfile.h"
 #include <mupdf/fitz.h>
 
 class QTabWidget;
@@ -24,15 +28,22 @@ class QMouseEvent;
 class QShowEvent;
 class QLabel;
 class QLineEdit;
+class QComboBox;
+class QSpinBox;
 class QTreeWidget;
 class QTreeWidgetItem;
 class QListWidgetItem;
+class QListView;
+class QModelIndex;
 class QTextEdit;
 class QPushButton;
-
-struct Note;
+class QActionGroup;
 
 class ViewerWidget;
+class SearchSession;
+class SearchResultsModel;
+class ExportJob;
+class NotesStore;
 
 class MainWindow : public QMainWindow
 {
@@ -60,6 +71,8 @@ private slots:
     void showTableOfContents();
     void onTocItemClicked(QTreeWidgetItem* item, int column);
     void setNotesDirectory();
+    void setLibraryFolder();
+    void exportDocument();
     void showNotes();
     void onNoteClicked(QListWidgetItem* item);
     void deleteSelectedNote();
@@ -69,7 +82,10 @@ private slots:
     void closeCurrentTab();
     void toggleStatusBar();
     void invertPageColors();
+    void chooseCustomPageColors();
     void renderActivePage();
+    void onPageRendered(const RenderResult& result);
+    void renderVisibleTiles();
     void nextPage();
     void prevPage();
     void zoomIn();
@@ -79,7 +95,7 @@ private slots:
     void promptForZoomLevel();
     void toggleFullScreen();
 
-    void onTextSelected(const QRect& rect);
+    void onTextSelected(const QRect& rect, int firstGlyph, int lastGlyph);
     void copySelection(const QString& selectedText);
     void savePassage(const QString& selectedText);
     void saveComment(const QString& selectedText);
@@ -92,13 +108,15 @@ private slots:
     void restoreLastTabs();
 
     void executeSearch(const QString& text);
-    void onSearchResultClicked(QListWidgetItem* item);
-    void onSearchResultChanged(QListWidgetItem* current, QListWidgetItem* previous);
+    void onSearchResultActivated(const QModelIndex& index);
     void findNextSearchResult();
     void findPrevSearchResult();
     void clearSearch();
+    void cancelSearch();
 
 private:
+    enum SearchScope { CurrentDocumentScope, OpenTabsScope, LibraryScope };
+
     void setupUI();
     void createActions();
     void createCustomTitleBar();
@@ -107,18 +125,31 @@ private:
     void createNotesDockWidget();
     void populateToc();
     void populateNotes();
-    QVector<Note> parseNotesFile(const QString& notesPath) const;
     void setupTheme();
     void updateStatusBar();
     void updateStatusBarActions();
     void loadAppSettings();
-    void openFileFromPath(const QString &filePath, int pageNum = 0);
+    // A negative pageNum keeps the page the document is already at.
+    void openFileFromPath(const QString &filePath, int pageNum = -1);
+    int addDocumentTab(Document *doc);
+    bool ensureDocumentLoaded(int index);
+    PageKey pageCacheKey(const RenderRequest& request) const;
+    QImage findZoomPreview(const RenderRequest& request);
+    void showTextLayer(ViewerWidget* viewer, const RenderRequest& request);
+    void setZoomFactor(qreal zoomFactor);
+    void schedulePrefetch(Document* doc);
+    void setColorMode(ColorMode mode);
+    void applyPageColors();
     void updateRecentFilesMenu();
     void updateFavoritesMenu();
     void clearSelectionState();
+    QString selectedText() const;
+    void updateSearchHighlights(bool ensureCurrentVisible);
+    SearchScope searchScope() const;
     void updateResizeCursor(const QPoint& pos);
     QString findNotesPathFor(const QString& bookPath) const;
     QString getNewNotesPathFor(const QString& bookPath) const;
+    NotesStore* notesStoreFor(const QString& notesPath);
 
     QWidget* m_customTitleBar;
     QToolButton* m_menuButton;
@@ -134,8 +165,13 @@ private:
 
 
     QDockWidget* m_searchDockWidget;
-    QListWidget* m_searchResultsList;
+    QListView* m_searchResultsView;
+    SearchResultsModel* m_searchResults;
     QLineEdit* m_searchInput;
+    QComboBox* m_searchModeCombo;
+    QComboBox* m_searchScopeCombo;
+    QSpinBox* m_fuzzyDistanceSpin;
+    QPushButton* m_matchDiacriticsButton;
     QDockWidget* m_tocDockWidget;
     QTreeWidget* m_tocTreeWidget;
     QDockWidget* m_notesDockWidget;
@@ -143,12 +179,14 @@ private:
     QTextEdit* m_noteEditor;
     QPushButton* m_saveNoteButton;
     QListWidgetItem* m_currentNoteItem;
+    QHash<QString, NotesStore*> m_notesStores;  // by notes path
 
     QAction* m_openAction;
     QAction* m_copyAction;
     QAction* m_searchAction;
     QAction* m_goToPageAction;
-    QAction* m_invertColorsAction;
+    QMenu* m_pageColorsMenu;
+    QActionGroup* m_colorModeGroup;
     QAction* m_toggleStatusBarAction;
     QAction* m_tocAction;
     QAction* m_notesAction;
@@ -156,8 +194,11 @@ private:
 
     QList<Document*> m_documents;
     AppSettings m_settings;
-    QCache<QString, QImage> m_pageCache;
+    PageCache m_pageCache;
+    qreal m_previousZoomFactor;
     QRect m_lastSelectionRect;
+    int m_selectionFirstGlyph;
+    int m_selectionLastGlyph;
     QRect m_resizeStartGeometry;
 
     bool m_isDragging;
@@ -167,4 +208,10 @@ private:
     bool m_isInitialShow;
 
     fz_context* m_mupdfContext;
+    RenderService* m_renderService;
+    SearchSession* m_searchSession;
+    QTimer* m_searchDebounceTimer;
+    ExportJob* m_exportJob;
+    bool m_searchResultsStale;
+    PagePrefetcher m_prefetcher;
 };
@@ -7,13 +7,30 @@
 #include <QInputDialog>
 #include <QWheelEvent>
 #include <QToolButton>
+#include <QColorDialog>
+#include <QActionGroup>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+
+// Pages larger than this at the current zoom are rendered as fixed-size tiles,
+// and only the tiles intersecting the viewport are rasterised.
+static const qreal TiledRenderPixels = 8.0 * 1024 * 1024;
+static const int TileSize = 512;
+
+// Ctrl+wheel and the zoom shortcuts step along this ladder (in percent), so the same
+// zoom levels keep recurring and their renders are served from the page cache.
+static const int ZoomLadder[] = { 10, 15, 20, 25, 33, 50, 67, 75, 90, 100, 110, 125, 150,
+                                  175, 200, 250, 300, 400, 500, 650, 800, 1000 };
+
+static int zoomPercent(qreal zoomFactor)
+{
+    return qRound(zoomFactor * 100);
+}
 
 void MainWindow::renderActivePage()
 {
     clearSelectionState();
-    if (auto* viewer = qobject_cast<ViewerWidget*>(m_tabWidget->currentWidget())) {
-        viewer->clearHighlight();
-    }
 
     int index = m_tabWidget->currentIndex();
     if (index < 0) {
@@ -25,33 +42,204 @@ void MainWindow::renderActivePage()
     int pageNum = doc->getCurrentPage();
     ViewerWidget* viewer = qobject_cast<ViewerWidget*>(m_tabWidget->widget(index));
     if (!viewer) return;
+    // Hits on the new page light up as soon as it is shown.
+    updateSearchHighlights(false);
 
-    QString cacheKey = QString("%1:%2:%3:%4")
-                           .arg(doc->getFilepath())
-                           .arg(pageNum)
-                           .arg(m_settings.zoomFactor)
-                           .arg(m_settings.invertPageColors);
+    RenderRequest request;
+    request.document = doc;
+    request.documentId = doc->getId();
+    request.pageNum = pageNum;
+    request.zoomFactor = m_settings.zoomFactor;
 
-    if (QImage* cachedImage = m_pageCache.object(cacheKey)) {
-        viewer->setPageImage(*cachedImage);
-        QVector<QRectF> charRects = doc->getPageCharRects(pageNum, m_settings.zoomFactor);
-        viewer->setCharRects(charRects);
+    const QSizeF pageSize = doc->getOriginalPageSize(pageNum) * m_settings.zoomFactor;
+    const QSize targetSize(qCeil(pageSize.width()), qCeil(pageSize.height()));
+    if (pageSize.width() * pageSize.height() > TiledRenderPixels) {
+        viewer->setTiledPage(targetSize);
+        if (QImage preview = findZoomPreview(request); !preview.isNull()) {
+            viewer->setPreviewImage(preview, targetSize);
+        }
+        showTextLayer(viewer, request);
+        renderVisibleTiles();
     } else {
-        QImage image = doc->renderCurrentPage(m_settings.zoomFactor, m_settings.invertPageColors);
-        if (!image.isNull()) {
-            m_pageCache.insert(cacheKey, new QImage(image), image.sizeInBytes());
-            viewer->setPageImage(image);
-            QVector<QRectF> charRects = doc->getPageCharRects(pageNum, m_settings.zoomFactor);
-            viewer->setCharRects(charRects);
+        if (QImage cachedImage = m_pageCache.find(pageCacheKey(request)); !cachedImage.isNull()) {
+            viewer->setPageImage(cachedImage);
+            showTextLayer(viewer, request);
         } else {
-            viewer->setPageImage(QImage());
+            if (QImage preview = findZoomPreview(request); !preview.isNull() && !targetSize.isEmpty()) {
+                viewer->setPreviewImage(preview, targetSize);
+                viewer->setTextLayer(QSharedPointer<const TextLayer>(), m_settings.zoomFactor);
+            }
+            m_renderService->requestPage(request);
         }
+        schedulePrefetch(doc);
     }
 
     updateStatusBar();
     updateStatusBarActions();
 }
 
+void MainWindow::onPageRendered(const RenderResult& result)
+{
+    const RenderRequest& request = result.request;
+
+    // Results already queued when a tab closed still arrive, and a document opened
+    // since may have been given the freed address, so only the id identifies it.
+    const auto open = std::find_if(m_documents.cbegin(), m_documents.cend(), [&request](const Document* doc) {
+        return doc->getId() == request.documentId;
+    });
+    if (open == m_documents.cend()) return;
+    Document* doc = *open;
+
+    if (request.textOnly) {
+        // Glyph boxes are in page space, so the layer fits whatever the zoom is now.
+        const int index = m_tabWidget->currentIndex();
+        if (index < 0 || m_documents.at(index) != doc || request.pageNum != doc->getCurrentPage()) return;
+        if (auto* viewer = qobject_cast<ViewerWidget*>(m_tabWidget->widget(index))) {
+            viewer->setTextLayer(result.textLayer, m_settings.zoomFactor);
+        }
+        return;
+    }
+
+    m_pageCache.insert(pageCacheKey(request), result.image);
+    if (request.tileRect.isNull()) {
+        m_prefetcher.recordRender(doc, result.renderMs, result.image.sizeInBytes());
+    }
+
+    // The user may have flipped, zoomed or switched tabs while the job was running.
+    int index = m_tabWidget->currentIndex();
+    if (index < 0 || m_documents.at(index) != doc) return;
+    if (request.pageNum != doc->getCurrentPage()
+        || request.zoomFactor != m_settings.zoomFactor) return;
+
+    auto* viewer = qobject_cast<ViewerWidget*>(m_tabWidget->widget(index));
+    if (!viewer) return;
+
+    if (!request.tileRect.isNull()) {
+        viewer->setTile(request.tileRect, result.image);
+    } else if (!viewer->isTiled()) {
+        viewer->setPageImage(result.image);
+        viewer->setTextLayer(result.textLayer, request.zoomFactor);
+    }
+}
+
+// Pages shown without a full render (from the cache, or as tiles) take their text
+// layer from the document's cache if it is there, and otherwise from a text-only
+// job, so the GUI thread never extracts text.
+void MainWindow::showTextLayer(ViewerWidget* viewer, const RenderRequest& request)
+{
+    const QSharedPointer<const TextLayer> layer = request.document->cachedTextLayer(request.pageNum);
+    viewer->setTextLayer(layer, m_settings.zoomFactor);
+    if (!layer) {
+        RenderRequest textRequest = request;
+        textRequest.tileRect = QRect();
+        textRequest.textOnly = true;
+        m_renderService->requestPage(textRequest);
+    }
+}
+
+void MainWindow::renderVisibleTiles()
+{
+    int index = m_tabWidget->currentIndex();
+    if (index < 0) return;
+
+    Document* doc = m_documents.at(index);
+    ViewerWidget* viewer = qobject_cast<ViewerWidget*>(m_tabWidget->widget(index));
+    if (!viewer || !viewer->isTiled()) return;
+
+    const QRect pageRect(QPoint(0, 0), viewer->pageSize());
+    const QRect visible = viewer->visiblePageRect();
+    if (visible.isEmpty()) return;
+
+    RenderRequest request;
+    request.document = doc;
+    request.documentId = doc->getId();
+    request.pageNum = doc->getCurrentPage();
+    request.zoomFactor = m_settings.zoomFactor;
+
+    for (int ty = visible.top() / TileSize; ty <= visible.bottom() / TileSize; ++ty) {
+        for (int tx = visible.left() / TileSize; tx <= visible.right() / TileSize; ++tx) {
+            request.tileRect = QRect(tx * TileSize, ty * TileSize, TileSize, TileSize) & pageRect;
+            if (viewer->hasTile(request.tileRect)) continue;
+
+            if (QImage cachedTile = m_pageCache.find(pageCacheKey(request)); !cachedTile.isNull()) {
+                viewer->setTile(request.tileRect, cachedTile);
+            } else {
+                m_renderService->requestPage(request);
+            }
+        }
+    }
+    viewer->pruneTiles(visible.adjusted(-TileSize, -TileSize, TileSize, TileSize));
+}
+
+PageKey MainWindow::pageCacheKey(const RenderRequest& request) const
+{
+    PageKey key;
+    key.documentId = request.documentId;
+    key.pageNum = request.pageNum;
+    key.zoomPercent = zoomPercent(request.zoomFactor);
+    if (!request.tileRect.isNull()) {
+        key.tileX = request.tileRect.x() / TileSize;
+        key.tileY = request.tileRect.y() / TileSize;
+    }
+    return key;
+}
+
+QImage MainWindow::findZoomPreview(const RenderRequest& request)
+{
+    QVector<qreal> candidates;
+    for (int step : ZoomLadder) {
+        candidates.append(step / 100.0);
+    }
+    if (m_previousZoomFactor > 0.0) {
+        candidates.append(m_previousZoomFactor);
+    }
+
+    RenderRequest candidate = request;
+    QImage preview;
+    qreal bestDistance = 0.0;
+    for (qreal zoomFactor : std::as_const(candidates)) {
+        if (zoomPercent(zoomFactor) == zoomPercent(request.zoomFactor)) continue;
+        candidate.zoomFactor = zoomFactor;
+        if (!m_pageCache.contains(pageCacheKey(candidate))) continue;
+        if (QImage image = m_pageCache.find(pageCacheKey(candidate)); !image.isNull()) {
+            const qreal distance = std::abs(std::log(zoomFactor / request.zoomFactor));
+            if (preview.isNull() || distance < bestDistance) {
+                preview = image;
+                bestDistance = distance;
+            }
+        }
+    }
+    return preview;
+}
+
+void MainWindow::setZoomFactor(qreal zoomFactor)
+{
+    const qreal quantized = std::clamp(zoomPercent(zoomFactor), 10, 1000) / 100.0;
+    if (quantized == m_settings.zoomFactor) return;
+
+    m_previousZoomFactor = m_settings.zoomFactor;
+    m_settings.zoomFactor = quantized;
+    renderActivePage();
+}
+
+void MainWindow::schedulePrefetch(Document* doc)
+{
+    const qint64 freeCacheBytes = m_pageCache.maxBytes() - m_pageCache.totalBytes();
+    const QVector<int> pages = m_prefetcher.plan(doc, doc->getCurrentPage(), doc->getPageCount(), freeCacheBytes);
+
+    m_renderService->cancelPrefetch(doc);
+    for (int pageNum : pages) {
+        RenderRequest request;
+        request.document = doc;
+        request.documentId = doc->getId();
+        request.pageNum = pageNum;
+        request.zoomFactor = m_settings.zoomFactor;
+        if (!m_pageCache.contains(pageCacheKey(request))) {
+            m_renderService->requestPage(request, RenderService::PrefetchPriority);
+        }
+    }
+}
+
 void MainWindow::updateStatusBarActions()
 {
     int index = m_tabWidget->currentIndex();
@@ -77,9 +265,7 @@ void MainWindow::promptForZoomLevel()
                                     currentZoomInt, 10, 1000, 1, &ok);
 
     if (ok && zoom != currentZoomInt) {
-        m_settings.zoomFactor = zoom / 100.0;
-        m_pageCache.clear();
-        renderActivePage();
+        setZoomFactor(zoom / 100.0);
     }
 }
 
@@ -93,10 +279,40 @@ void MainWindow::toggleStatusBar()
 
 void MainWindow::invertPageColors()
 {
-    m_settings.invertPageColors = !m_settings.invertPageColors;
-    m_invertColorsAction->setChecked(m_settings.invertPageColors);
-    m_pageCache.clear();
-    renderActivePage();
+    setColorMode(m_settings.colorMode == ColorMode::Invert ? ColorMode::Normal : ColorMode::Invert);
+}
+
+void MainWindow::chooseCustomPageColors()
+{
+    QColor paper = QColorDialog::getColor(m_settings.customPaperColor, this, QStringLiteral("Page Background Color"));
+    if (!paper.isValid()) return;
+    QColor ink = QColorDialog::getColor(m_settings.customInkColor, this, QStringLiteral("Page Text Color"));
+    if (!ink.isValid()) return;
+
+    m_settings.customPaperColor = paper;
+    m_settings.customInkColor = ink;
+    setColorMode(ColorMode::Custom);
+}
+
+void MainWindow::setColorMode(ColorMode mode)
+{
+    m_settings.colorMode = mode;
+    applyPageColors();
+}
+
+void MainWindow::applyPageColors()
+{
+    for (QAction* action : m_colorModeGroup->actions()) {
+        action->setChecked(ColorMode(action->data().toInt()) == m_settings.colorMode);
+    }
+
+    // Colours are applied on top of the cached renders, so nothing is re-rendered.
+    const ColorFilter filter = m_settings.pageColorFilter();
+    for (int i = 0; i < m_tabWidget->count(); ++i) {
+        if (auto* viewer = qobject_cast<ViewerWidget*>(m_tabWidget->widget(i))) {
+            viewer->setColorFilter(filter);
+        }
+    }
 }
 
 void MainWindow::nextPage()
@@ -117,16 +333,20 @@ void MainWindow::prevPage()
 
 void MainWindow::zoomIn()
 {
-    m_settings.zoomFactor *= 1.1;
-    m_pageCache.clear();
-    renderActivePage();
+    const int current = zoomPercent(m_settings.zoomFactor);
+    auto next = std::upper_bound(std::begin(ZoomLadder), std::end(ZoomLadder), current);
+    if (next != std::end(ZoomLadder)) {
+        setZoomFactor(*next / 100.0);
+    }
 }
 
 void MainWindow::zoomOut()
 {
-    m_settings.zoomFactor /= 1.1;
-    m_pageCache.clear();
-    renderActivePage();
+    const int current = zoomPercent(m_settings.zoomFactor);
+    auto next = std::lower_bound(std::begin(ZoomLadder), std::end(ZoomLadder), current);
+    if (next != std::begin(ZoomLadder)) {
+        setZoomFactor(*std::prev(next) / 100.0);
+    }
 }
 
 void MainWindow::fitToWindow()
@@ -146,10 +366,8 @@ void MainWindow::fitToWindow()
 
     qreal xZoom = viewportRect.width() / pageSize.width();
     qreal yZoom = viewportRect.height() / pageSize.height();
-    m_settings.zoomFactor = std::min(xZoom, yZoom);
-
-    m_pageCache.clear();
-    renderActivePage();
+    // Round down to a whole percent so the page still fits once quantised.
+    setZoomFactor(std::floor(std::min(xZoom, yZoom) * 100) / 100.0);
 }
 
 void MainWindow::promptForPageNumber()
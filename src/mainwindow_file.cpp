@@ -2,6 +2,8 @@
 #include "viewerwidget.h"
 #include "favoritesdialog.h"
 #include "document.h"
+#include "exportjob.h"
+#include "notesstore.h"
 
 #include <QFileDialog>
 #include <QMessageBox>
@@ -12,17 +14,56 @@
 #include <QMenu>
 #include <QDir>
 #include <QPushButton>
+#include <QSignalBlocker>
+#include <QTimer>
+#include <QProgressDialog>
 
 void MainWindow::restoreLastTabs()
 {
-    for (const QVariant &tabData : m_settings.lastOpenTabs) {
-        QVariantMap map = tabData.toMap();
-        QString filePath = map.value("filePath").toString();
-        int pageNum = map.value("pageNum").toInt();
-        if (!filePath.isEmpty()) {
-            openFileFromPath(filePath, pageNum);
+    // Tabs come back as placeholders; a document is only opened and rendered when
+    // its tab is first shown.
+    {
+        const QSignalBlocker blocker(m_tabWidget);
+        for (const QVariant &tabData : m_settings.lastOpenTabs) {
+            QVariantMap map = tabData.toMap();
+            QString filePath = map.value("filePath").toString();
+            int pageNum = map.value("pageNum").toInt();
+            if (filePath.isEmpty()) continue;
+
+            Document *doc = new Document(m_mupdfContext, filePath);
+            doc->goToPage(pageNum);
+            m_documents.append(doc);
+            m_tabWidget->setCurrentIndex(addDocumentTab(doc));
         }
     }
+
+    if (m_tabWidget->count() > 0) {
+        onTabChanged(m_tabWidget->currentIndex());
+    }
+}
+
+bool MainWindow::ensureDocumentLoaded(int index)
+{
+    Document *doc = m_documents.at(index);
+    if (doc->load()) return true;
+
+    QMessageBox::critical(this, "Error", QStringLiteral("Failed to load %1.").arg(doc->getFilepath()));
+    QTimer::singleShot(0, this, [this, doc] {
+        int i = m_documents.indexOf(doc);
+        if (i >= 0) onTabCloseRequested(i);
+    });
+    return false;
+}
+
+int MainWindow::addDocumentTab(Document *doc)
+{
+    ViewerWidget *viewer = new ViewerWidget(this);
+    viewer->setColorFilter(m_settings.pageColorFilter());
+    viewer->setContextMenuPolicy(Qt::CustomContextMenu);
+    connect(viewer, &ViewerWidget::customContextMenuRequested, this, &MainWindow::showPageContextMenu);
+    connect(viewer, &ViewerWidget::textSelected, this, &MainWindow::onTextSelected);
+    connect(viewer, &ViewerWidget::viewportChanged, this, &MainWindow::renderVisibleTiles);
+    return m_tabWidget->addTab(viewer, QFileInfo(doc->getFilepath()).fileName());
 }
 
 void MainWindow::openFile()
@@ -36,9 +77,17 @@ void MainWindow::openFile()
 
 void MainWindow::openFileFromPath(const QString &filePath, int pageNum)
 {
+    const QString absolutePath = QFileInfo(filePath).absoluteFilePath();
     for(int i = 0; i < m_documents.count(); ++i) {
-        if(m_documents.at(i)->getFilepath() == filePath) {
-            m_tabWidget->setCurrentIndex(i);
+        if(QFileInfo(m_documents.at(i)->getFilepath()).absoluteFilePath() == absolutePath) {
+            Document* doc = m_documents.at(i);
+            const int previousPage = doc->getCurrentPage();
+            if (pageNum >= 0) doc->goToPage(pageNum);
+            if (m_tabWidget->currentIndex() != i) {
+                m_tabWidget->setCurrentIndex(i);
+            } else if (doc->getCurrentPage() != previousPage) {
+                renderActivePage();
+            }
             return;
         }
     }
@@ -49,18 +98,14 @@ void MainWindow::openFileFromPath(const QString &filePath, int pageNum)
         return;
     }
 
-    doc->goToPage(pageNum);
+    if (pageNum >= 0) doc->goToPage(pageNum);
 
     m_documents.append(doc);
     m_settings.recentFiles.removeAll(filePath);
     m_settings.recentFiles.prepend(filePath);
     while(m_settings.recentFiles.size() > 15) m_settings.recentFiles.removeLast();
     updateRecentFilesMenu();
-    ViewerWidget *viewer = new ViewerWidget(this);
-    viewer->setContextMenuPolicy(Qt::CustomContextMenu);
-    connect(viewer, &ViewerWidget::customContextMenuRequested, this, &MainWindow::showPageContextMenu);
-    connect(viewer, &ViewerWidget::textSelected, this, &MainWindow::onTextSelected);
-    int newTabIndex = m_tabWidget->addTab(viewer, QFileInfo(filePath).fileName());
+    int newTabIndex = addDocumentTab(doc);
     m_tabWidget->setCurrentIndex(newTabIndex);
     renderActivePage();
     populateToc();
@@ -124,6 +169,55 @@ void MainWindow::setNotesDirectory()
     }
 }
 
+void MainWindow::setLibraryFolder()
+{
+    const QString start = m_settings.libraryFolder.isEmpty() ? QDir::homePath() : m_settings.libraryFolder;
+    QString dir = QFileDialog::getExistingDirectory(this, "Select Library Folder", start);
+    if (!dir.isEmpty()) {
+        m_settings.libraryFolder = dir;
+        m_settings.save();
+    }
+}
+
+void MainWindow::exportDocument()
+{
+    const int index = m_tabWidget->currentIndex();
+    if (index < 0 || m_exportJob || !ensureDocumentLoaded(index)) return;
+
+    Document* doc = m_documents.at(index);
+    const QFileInfo source(doc->getFilepath());
+    const QString textFilter = QStringLiteral("Plain Text (*.txt)");
+    const QString markdownFilter = QStringLiteral("Markdown (*.md)");
+    QString selectedFilter = textFilter;
+    const QString outputPath = QFileDialog::getSaveFileName(this, "Export As", source.dir().filePath(source.completeBaseName() + ".txt"),
+                                                            textFilter + ";;" + markdownFilter, &selectedFilter);
+    if (outputPath.isEmpty()) return;
+
+    const bool markdown = selectedFilter == markdownFilter || outputPath.endsWith(".md", Qt::CaseInsensitive);
+    m_exportJob = new ExportJob(m_mupdfContext, doc->getFilepath(), doc->getPageCount(), outputPath,
+                                markdown ? ExportJob::Markdown : ExportJob::PlainText, this);
+    if (markdown) {
+        m_exportJob->setTableOfContents(doc->getTableOfContents());
+    }
+
+    QProgressDialog* progress = new QProgressDialog(QStringLiteral("Exporting %1...").arg(source.fileName()), QStringLiteral("Cancel"),
+                                                    0, doc->getPageCount(), this);
+    progress->setWindowModality(Qt::WindowModal);
+    progress->setMinimumDuration(500);
+    connect(progress, &QProgressDialog::canceled, m_exportJob, &ExportJob::cancel);
+    connect(m_exportJob, &ExportJob::progress, progress, &QProgressDialog::setValue);
+    connect(m_exportJob, &ExportJob::finished, this, [this, progress, outputPath](bool succeeded, const QString& errorString) {
+        progress->deleteLater();
+        m_exportJob->deleteLater();
+        m_exportJob = nullptr;
+        if (succeeded) {
+            m_statusBar->showMessage(QStringLiteral("Exported to %1").arg(QDir::toNativeSeparators(outputPath)), 5000);
+        } else if (!errorString.isEmpty()) {
+            QMessageBox::warning(this, "Export Failed", QStringLiteral("Could not export to %1:\n%2").arg(QDir::toNativeSeparators(outputPath), errorString));
+        }
+    });
+    m_exportJob->start();
+}
 
 void MainWindow::updateRecentFilesMenu()
 {
@@ -179,8 +273,11 @@ void MainWindow::onTabChanged(int index)
     updateStatusBarActions();
 
     if (index >= 0) {
+        if (!ensureDocumentLoaded(index)) return;
+        m_pageCache.setActiveDocument(m_documents.at(index)->getId());
         renderActivePage();
-        clearSearch();
+        // Results from several files stay up while moving between them.
+        if (searchScope() == CurrentDocumentScope) clearSearch();
         updateFavoritesMenu();
         populateToc();
         populateNotes();
@@ -204,9 +301,13 @@ void MainWindow::onTabCloseRequested(int index)
 
     if (index < m_documents.count()) {
         Document* doc = m_documents.takeAt(index);
+        delete m_notesStores.take(findNotesPathFor(doc->getFilepath()));
+        m_renderService->cancelDocument(doc);
+        m_prefetcher.forget(doc);
+        m_pageCache.removeDocument(doc->getId());
         delete doc;
     }
-    clearSearch();
+    if (searchScope() == CurrentDocumentScope) clearSearch();
 }
 
 void MainWindow::closeCurrentTab()
@@ -236,6 +337,13 @@ QString MainWindow::findNotesPathFor(const QString& bookPath) const
     return QString();
 }
 
+NotesStore* MainWindow::notesStoreFor(const QString& notesPath)
+{
+    NotesStore*& store = m_notesStores[notesPath];
+    if (!store) store = new NotesStore(notesPath, this);
+    return store;
+}
+
 QString MainWindow::getNewNotesPathFor(const QString& bookPath) const
 {
     const QFileInfo bookInfo(bookPath);
@@ -1,81 +1,14 @@
 #include "mainwindow.h"
 #include "viewerwidget.h"
+#include "notesstore.h"
 #include <QDockWidget>
 #include <QListWidget>
 #include <QPushButton>
 #include <QVBoxLayout>
-#include <QRegularExpression>
 #include <QFile>
-#include <QTextStream>
 #include <QMessageBox>
 #include <QTextEdit>
 
-struct Note {
-    enum NoteType { Passage, Comment, PageNote };
-    NoteType type;
-    int pageNum = -1;
-    QString dateTime;
-    QString content;
-    QString comment;
-    QRectF location;
-    qint64 filePos = -1;
-    qint64 fileEndPos = -1;
-};
-Q_DECLARE_METATYPE(Note)
-
-QVector<Note> MainWindow::parseNotesFile(const QString& notesPath) const
-{
-    QVector<Note> notes;
-    QFile file(notesPath);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        return notes;
-    }
-
-    QTextStream in(&file);
-    const QString content = in.readAll();
-    file.close();
-
-    QRegularExpression headerRegex(R"(\n\nPage (\d+)( NOTE)? \((.*?)\)(?: \[([\d\.-]+),([\d\.-]+),([\d\.-]+),([\d\.-]+)\])?\n)");
-    QRegularExpressionMatchIterator i = headerRegex.globalMatch(content);
-    QVector<QRegularExpressionMatch> matches;
-    while(i.hasNext()){
-        matches.append(i.next());
-    }
-
-    for(int j = 0; j < matches.size(); ++j) {
-        const QRegularExpressionMatch& match = matches[j];
-        Note note;
-        note.filePos = match.capturedStart();
-        note.pageNum = match.captured(1).toInt();
-        note.dateTime = match.captured(3);
-
-        if (!match.captured(4).isNull()) {
-            note.location = QRectF(match.captured(4).toDouble(), match.captured(5).toDouble(),
-                                   match.captured(6).toDouble(), match.captured(7).toDouble());
-        }
-
-        qint64 contentStart = match.capturedEnd();
-        qint64 contentEnd = (j + 1 < matches.size()) ? matches[j+1].capturedStart() : content.length();
-        note.fileEndPos = contentEnd;
-
-        QString noteBody = content.mid(contentStart, contentEnd - contentStart).trimmed();
-
-        if (match.captured(2).contains("NOTE")) {
-            note.type = Note::PageNote;
-            note.content = noteBody;
-        } else if (noteBody.contains("\n\nCOMMENT: ")) {
-            note.type = Note::Comment;
-            note.content = noteBody.section("\n\nCOMMENT: ", 0, 0);
-            note.comment = noteBody.section("\n\nCOMMENT: ", 1, 1);
-        } else {
-            note.type = Note::Passage;
-            note.content = noteBody;
-        }
-        notes.append(note);
-    }
-    return notes;
-}
-
 void MainWindow::createNotesDockWidget()
 {
     m_notesDockWidget = new QDockWidget("Notes", this);
@@ -133,7 +66,7 @@ void MainWindow::populateNotes()
         return;
     }
 
-    QVector<Note> notes = parseNotesFile(notesPath);
+    const QVector<Note> notes = notesStoreFor(notesPath)->notes();
     if (notes.isEmpty()) {
         m_notesAction->setEnabled(false);
         m_notesDockWidget->hide();
@@ -216,18 +149,8 @@ void MainWindow::deleteSelectedNote()
         QString bookPath = m_documents.at(m_tabWidget->currentIndex())->getFilepath();
         QString notesPath = findNotesPathFor(bookPath);
 
-        QFile file(notesPath);
-        if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-            QString content = file.readAll();
-            file.close();
-
-            content.remove(note.filePos, note.fileEndPos - note.filePos);
-
-            if (file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
-                QTextStream out(&file);
-                out << content;
-                file.close();
-            }
+        if (notesPath.isEmpty() || !notesStoreFor(notesPath)->remove(note)) {
+            QMessageBox::warning(this, "Error", "Could not delete the note.");
         }
         populateNotes();
     }
@@ -240,21 +163,21 @@ void MainWindow::saveNoteChanges()
     QVariant data = m_currentNoteItem->data(Qt::UserRole);
     if (!data.canConvert<Note>()) return;
 
-    Note note = data.value<Note>();
+    // The note is passed to the store as listed, as its text is what finds it
+    // again once a compaction has moved it in the file.
+    const Note note = data.value<Note>();
     QString newText = m_noteEditor->toPlainText();
 
     QString newNoteBlock;
     if (note.type == Note::PageNote) {
-        note.content = newText;
         newNoteBlock = QString("\n\nPage %1 NOTE (%2)\n%3")
-                           .arg(note.pageNum).arg(note.dateTime).arg(note.content);
+                           .arg(note.pageNum).arg(note.dateTime).arg(newText);
     } else if (note.type == Note::Comment) {
-        note.comment = newText;
         QString rectString = QString("[%1,%2,%3,%4]")
                                  .arg(note.location.x()).arg(note.location.y())
                                  .arg(note.location.width()).arg(note.location.height());
         newNoteBlock = QString("\n\nPage %1 (%2) %3\n%4\n\nCOMMENT: %5")
-                           .arg(note.pageNum).arg(note.dateTime).arg(rectString).arg(note.content).arg(note.comment);
+                           .arg(note.pageNum).arg(note.dateTime).arg(rectString).arg(note.content).arg(newText);
     } else {
         return;
     }
@@ -262,14 +185,8 @@ void MainWindow::saveNoteChanges()
     QString bookPath = m_documents.at(m_tabWidget->currentIndex())->getFilepath();
     QString notesPath = findNotesPathFor(bookPath);
 
-    QFile file(notesPath);
-    if (file.open(QIODevice::ReadWrite | QIODevice::Text)) {
-        QString content = file.readAll();
-        content.replace(note.filePos, note.fileEndPos - note.filePos, newNoteBlock);
-        file.resize(0);
-        QTextStream out(&file);
-        out << content;
-        file.close();
+    if (notesPath.isEmpty() || !notesStoreFor(notesPath)->replace(note, newNoteBlock)) {
+        QMessageBox::warning(this, "Error", "Could not save changes to the note.");
     }
     populateNotes();
 }
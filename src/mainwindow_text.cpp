@@ -1,37 +1,47 @@
 #include "mainwindow.h"
 #include "viewerwidget.h"
+#include "searchsession.h"
+#include "searchresultsmodel.h"
+#include "notesstore.h"
 #include <QApplication>
 #include <QClipboard>
 #include <QFileInfo>
-#include <QFile>
-#include <QTextStream>
 #include <QMessageBox>
 #include <QDateTime>
 #include <QInputDialog>
 #include <QMenu>
-#include <QListWidget>
+#include <QListView>
+#include <QComboBox>
+#include <QPushButton>
 #include <QTabWidget>
 #include <QDebug>
 #include <QDir>
+#include <algorithm>
 
-void MainWindow::onTextSelected(const QRect& rect)
+void MainWindow::onTextSelected(const QRect& rect, int firstGlyph, int lastGlyph)
 {
-    if (rect.isNull()) {
+    if (rect.isNull() || firstGlyph < 0) {
         clearSelectionState();
         return;
     }
 
-    Document* doc = m_documents.at(m_tabWidget->currentIndex());
-    QString selectedText = doc->getSelectedText(rect, m_settings.zoomFactor);
-
-    if (!selectedText.trimmed().isEmpty()) {
-        m_lastSelectionRect = rect;
+    m_lastSelectionRect = rect;
+    m_selectionFirstGlyph = firstGlyph;
+    m_selectionLastGlyph = lastGlyph;
+    if (!selectedText().trimmed().isEmpty()) {
         m_copyAction->setEnabled(true);
     } else {
         clearSelectionState();
     }
 }
 
+QString MainWindow::selectedText() const
+{
+    const int index = m_tabWidget->currentIndex();
+    if (index < 0 || !m_lastSelectionRect.isValid()) return QString();
+    return m_documents.at(index)->getSelectedText(m_selectionFirstGlyph, m_selectionLastGlyph);
+}
+
 void MainWindow::copySelection(const QString& selectedText)
 {
     if (!selectedText.isEmpty()) {
@@ -50,25 +60,22 @@ void MainWindow::savePassage(const QString& selectedText)
         notesPath = getNewNotesPathFor(doc->getFilepath());
     }
 
-    QFile notesFile(notesPath);
-    if (!notesFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
-        QMessageBox::warning(this, QStringLiteral("Error"), QStringLiteral("Could not write to notes file."));
-        return;
-    }
-
     QRectF unscaledRect(m_lastSelectionRect.x() / m_settings.zoomFactor,
                         m_lastSelectionRect.y() / m_settings.zoomFactor,
                         m_lastSelectionRect.width() / m_settings.zoomFactor,
                         m_lastSelectionRect.height() / m_settings.zoomFactor);
 
-    QTextStream out(&notesFile);
     QString location = QString("Page %1").arg(doc->getCurrentPage() + 1);
     QString dateTime = QDateTime::currentDateTime().toString(Qt::ISODate);
     QString rectString = QString("[%1,%2,%3,%4]")
                              .arg(unscaledRect.x()).arg(unscaledRect.y())
                              .arg(unscaledRect.width()).arg(unscaledRect.height());
 
-    out << "\n\n" << location << " (" << dateTime << ") " << rectString << "\n" << selectedText;
+    const QString block = "\n\n" + location + " (" + dateTime + ") " + rectString + "\n" + selectedText;
+    if (!notesStoreFor(notesPath)->append(block)) {
+        QMessageBox::warning(this, QStringLiteral("Error"), QStringLiteral("Could not write to notes file."));
+        return;
+    }
 
     clearSelectionState();
     populateNotes();
@@ -89,26 +96,23 @@ void MainWindow::saveComment(const QString& selectedText)
             notesPath = getNewNotesPathFor(doc->getFilepath());
         }
 
-        QFile notesFile(notesPath);
-        if (!notesFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
-            QMessageBox::warning(this, QStringLiteral("Error"), QStringLiteral("Could not write to notes file."));
-            return;
-        }
-
         QRectF unscaledRect(m_lastSelectionRect.x() / m_settings.zoomFactor,
                             m_lastSelectionRect.y() / m_settings.zoomFactor,
                             m_lastSelectionRect.width() / m_settings.zoomFactor,
                             m_lastSelectionRect.height() / m_settings.zoomFactor);
 
-        QTextStream out(&notesFile);
         QString location = QString("Page %1").arg(doc->getCurrentPage() + 1);
         QString dateTime = QDateTime::currentDateTime().toString(Qt::ISODate);
         QString rectString = QString("[%1,%2,%3,%4]")
                                  .arg(unscaledRect.x()).arg(unscaledRect.y())
                                  .arg(unscaledRect.width()).arg(unscaledRect.height());
 
-        out << "\n\n" << location << " (" << dateTime << ") " << rectString << "\n" << selectedText;
-        out << "\n\nCOMMENT: " << commentText;
+        const QString block = "\n\n" + location + " (" + dateTime + ") " + rectString + "\n" + selectedText
+            + "\n\nCOMMENT: " + commentText;
+        if (!notesStoreFor(notesPath)->append(block)) {
+            QMessageBox::warning(this, QStringLiteral("Error"), QStringLiteral("Could not write to notes file."));
+            return;
+        }
     }
 
     clearSelectionState();
@@ -129,17 +133,13 @@ void MainWindow::savePageNote()
             notesPath = getNewNotesPathFor(doc->getFilepath());
         }
 
-        QFile notesFile(notesPath);
-        if (!notesFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        const QString location = QStringLiteral("Page %1").arg(doc->getCurrentPage() + 1);
+        const QString dateTime = QDateTime::currentDateTime().toString(Qt::ISODate);
+        const QString block = "\n\n" + location + " NOTE (" + dateTime + ")\n" + commentText;
+        if (!notesStoreFor(notesPath)->append(block)) {
             QMessageBox::warning(this, QStringLiteral("Error"), QStringLiteral("Could not write to notes file."));
             return;
         }
-
-        QTextStream out(&notesFile);
-        const QString location = QStringLiteral("Page %1").arg(doc->getCurrentPage() + 1);
-        const QString dateTime = QDateTime::currentDateTime().toString(Qt::ISODate);
-        out << "\n\n" << location << " NOTE (" << dateTime << ")\n";
-        out << commentText;
     }
     populateNotes();
 }
@@ -154,8 +154,7 @@ void MainWindow::showPageContextMenu(const QPoint& pos)
     QMenu contextMenu(this);
 
     if (viewer->hasSelection()) {
-        Document* doc = m_documents.at(index);
-        QString selectedText = doc->getSelectedText(m_lastSelectionRect, m_settings.zoomFactor);
+        const QString selectedText = this->selectedText();
 
         if (!selectedText.trimmed().isEmpty()) {
             QAction* copyAct = contextMenu.addAction(QStringLiteral("Copy - ctrl + c"));
@@ -177,20 +176,14 @@ void MainWindow::showPageContextMenu(const QPoint& pos)
 void MainWindow::onSavePassageShortcut()
 {
     if (m_lastSelectionRect.isValid()) {
-        Document* doc = m_documents.at(m_tabWidget->currentIndex());
-        if (!doc) return;
-        QString selectedText = doc->getSelectedText(m_lastSelectionRect, m_settings.zoomFactor);
-        savePassage(selectedText);
+        savePassage(selectedText());
     }
 }
 
 void MainWindow::onSaveCommentShortcut()
 {
     if (m_lastSelectionRect.isValid()) {
-        Document* doc = m_documents.at(m_tabWidget->currentIndex());
-        if (!doc) return;
-        QString selectedText = doc->getSelectedText(m_lastSelectionRect, m_settings.zoomFactor);
-        saveComment(selectedText);
+        saveComment(selectedText());
     }
 }
 
@@ -199,101 +192,161 @@ void MainWindow::onSavePageNoteShortcut()
     savePageNote();
 }
 
+MainWindow::SearchScope MainWindow::searchScope() const
+{
+    if (!m_searchScopeCombo) return CurrentDocumentScope;
+    return static_cast<SearchScope>(m_searchScopeCombo->currentData().toInt());
+}
+
 void MainWindow::executeSearch(const QString& text)
 {
-    m_searchResultsList->clear();
+    const SearchScope scope = searchScope();
     int index = m_tabWidget->currentIndex();
-    if (index < 0 || text.isEmpty()) {
+    if ((index < 0 && scope != LibraryScope) || text.simplified().isEmpty()) {
+        cancelSearch();
+        m_searchResults->clear();
+        updateSearchHighlights(false);
         return;
     }
 
-    Document* doc = m_documents.at(index);
-    QVector<SearchResult> results = doc->searchDocument(text);
+    SearchQuery query;
+    query.text = text;
+    query.mode = static_cast<SearchQuery::Mode>(m_searchModeCombo->currentData().toInt());
+    query.maxDistance = m_fuzzyDistanceSpin->value();
+    query.matchDiacritics = m_matchDiacriticsButton->isChecked();
+    QSharedPointer<const CompiledQuery> compiled = CompiledQuery::compile(query);
+    if (!compiled->isValid()) {
+        cancelSearch();
+        m_searchResults->clear();
+        m_searchResults->setMessage(QStringLiteral("Invalid search: %1").arg(compiled->errorString()));
+        updateSearchHighlights(false);
+        m_searchDockWidget->show();
+        return;
+    }
 
-    if (results.isEmpty()) {
-        m_searchResultsList->addItem(QStringLiteral("No results found."));
+    SearchSession* session = new SearchSession(m_mupdfContext, compiled, this);
+    if (scope == CurrentDocumentScope) {
+        Document* doc = m_documents.at(index);
+        session->addDocument(doc->getFilepath(), doc->getPageCount());
     } else {
-        for (const SearchResult& result : results) {
-            QListWidgetItem* item = new QListWidgetItem(
-                QStringLiteral("Page %1: %2").arg(result.pageNum + 1).arg(result.context),
-                m_searchResultsList
-                );
-            item->setData(Qt::UserRole, QVariant::fromValue(result));
+        // Restored tabs that were never shown are counted by the session.
+        for (Document* doc : std::as_const(m_documents)) {
+            session->addDocument(doc->getFilepath(), doc->isLoaded() ? doc->getPageCount() : 0);
+        }
+        if (scope == LibraryScope) {
+            session->addFolder(m_settings.libraryFolder);
         }
     }
+    if (m_searchSession) {
+        session->refineFrom(*m_searchSession);
+    }
+    cancelSearch();
+    m_searchSession = session;
+
+    // The previous hits stay up until the first batch of new ones replaces them,
+    // so the list doesn't blank out on every keystroke.
+    m_searchResultsStale = true;
+    auto replaceStaleResults = [this, scope] {
+        if (m_searchResultsStale) {
+            m_searchResults->clear();
+            m_searchResults->setFileHeaders(scope != CurrentDocumentScope);
+            m_searchResultsStale = false;
+            updateSearchHighlights(false);
+        }
+    };
+    connect(m_searchSession, &SearchSession::resultsFound, this, [this, replaceStaleResults](const QString& filepath, const QVector<SearchResult>& results) {
+        replaceStaleResults();
+        m_searchResults->appendResults(filepath, results);
+
+        const int tabIndex = m_tabWidget->currentIndex();
+        if (tabIndex < 0) return;
+        const Document* doc = m_documents.at(tabIndex);
+        const int currentPage = doc->getCurrentPage();
+        if (QFileInfo(doc->getFilepath()).absoluteFilePath() == filepath
+            && std::any_of(results.cbegin(), results.cend(), [currentPage](const SearchResult& r) { return r.pageNum == currentPage; })) {
+            updateSearchHighlights(false);
+        }
+    });
+    connect(m_searchSession, &SearchSession::finished, this, [this, replaceStaleResults] {
+        replaceStaleResults();
+        m_searchResults->setMessage(QStringLiteral("No results found."));
+    });
+    m_searchSession->start();
     m_searchDockWidget->show();
 }
 
-void MainWindow::onSearchResultClicked(QListWidgetItem* item)
+void MainWindow::cancelSearch()
 {
-    if (!item) return;
+    // Deleting the session cancels its jobs; their workers wind down on their own.
+    delete m_searchSession;
+    m_searchSession = nullptr;
+}
+
+void MainWindow::onSearchResultActivated(const QModelIndex& index)
+{
+    if (!m_searchResults->isResult(index)) return;
 
-    QVariant data = item->data(Qt::UserRole);
-    if (!data.canConvert<SearchResult>()) return;
+    // Copied, as opening a document can feed the model more results.
+    const SearchResult result = m_searchResults->result(index.row());
+    openFileFromPath(m_searchResults->filepath(index.row()), result.pageNum);
+    updateSearchHighlights(true);
+}
 
-    SearchResult currentResult = data.value<SearchResult>();
+void MainWindow::updateSearchHighlights(bool ensureCurrentVisible)
+{
     int tabIndex = m_tabWidget->currentIndex();
     if (tabIndex < 0) return;
 
-    Document* doc = m_documents.at(tabIndex);
-    ViewerWidget* viewer = qobject_cast<ViewerWidget*>(m_tabWidget->widget(tabIndex));
-    if (!doc || !viewer) return;
-
-    auto highlightAction = [=] {
-        QVector<QRectF> allHighlightsOnPage;
-        for (int i = 0; i < m_searchResultsList->count(); ++i) {
-            QListWidgetItem* listItem = m_searchResultsList->item(i);
-            if (auto listData = listItem->data(Qt::UserRole); listData.canConvert<SearchResult>()) {
-                SearchResult r = listData.value<SearchResult>();
-                if (r.pageNum == currentResult.pageNum) {
-                    allHighlightsOnPage.append(r.location);
-                }
-            }
-        }
-        viewer->setHighlights(allHighlightsOnPage, currentResult.location, m_settings.zoomFactor);
-    };
+    auto* viewer = qobject_cast<ViewerWidget*>(m_tabWidget->widget(tabIndex));
+    if (!viewer) return;
 
-    if (doc->getCurrentPage() != currentResult.pageNum) {
-        doc->goToPage(currentResult.pageNum);
-        renderActivePage();
+    if (!m_searchResults || !m_searchResults->hasResults()) {
+        viewer->clearHighlight();
+        return;
     }
 
-    highlightAction();
-}
+    Document* doc = m_documents.at(tabIndex);
+    const QString filepath = QFileInfo(doc->getFilepath()).absoluteFilePath();
+    const int pageNum = doc->getCurrentPage();
+    const QVector<QRectF> locations = m_searchResults->locationsOnPage(filepath, pageNum);
+    if (locations.isEmpty()) {
+        viewer->clearHighlight();
+        return;
+    }
 
-void MainWindow::onSearchResultChanged(QListWidgetItem* current, QListWidgetItem* /*previous*/)
-{
-    onSearchResultClicked(current);
+    QRectF current;
+    const QModelIndex currentIndex = m_searchResultsView->currentIndex();
+    if (m_searchResults->isResult(currentIndex) && m_searchResults->filepath(currentIndex.row()) == filepath) {
+        const SearchResult& result = m_searchResults->result(currentIndex.row());
+        if (result.pageNum == pageNum) current = result.location;
+    }
+    viewer->setHighlights(locations, current, m_settings.zoomFactor, ensureCurrentVisible && !current.isNull());
 }
 
 void MainWindow::findNextSearchResult()
 {
-    int count = m_searchResultsList->count();
-    if (count <= 1) return;
-
-    int nextRow = m_searchResultsList->currentRow() + 1;
-    if (nextRow >= count) {
-        nextRow = 0;
+    const int row = m_searchResults->nextResultRow(m_searchResultsView->currentIndex().row(), 1);
+    if (row >= 0) {
+        m_searchResultsView->setCurrentIndex(m_searchResults->index(row));
     }
-    m_searchResultsList->setCurrentRow(nextRow);
 }
 
 void MainWindow::findPrevSearchResult()
 {
-    int count = m_searchResultsList->count();
-    if (count <= 1) return;
-
-    int prevRow = m_searchResultsList->currentRow() - 1;
-    if (prevRow < 0) {
-        prevRow = count - 1;
+    const int row = m_searchResults->nextResultRow(m_searchResultsView->currentIndex().row(), -1);
+    if (row >= 0) {
+        m_searchResultsView->setCurrentIndex(m_searchResults->index(row));
     }
-    m_searchResultsList->setCurrentRow(prevRow);
 }
 
 void MainWindow::clearSearch()
 {
-    if (m_searchResultsList) {
-        m_searchResultsList->clear();
+    cancelSearch();
+    if (m_searchDebounceTimer) {
+        m_searchDebounceTimer->stop();
+    }
+    if (m_searchResults) {
+        m_searchResults->clear();
     }
     if (auto* viewer = qobject_cast<ViewerWidget*>(m_tabWidget->currentWidget())) {
         viewer->clearHighlight();
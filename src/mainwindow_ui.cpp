@@ -1,5 +1,8 @@
 #include "mainwindow.h"
 #include "viewerwidget.h"
+#include "searchquery.h"
+#include "searchresultsmodel.h"
+#include "searchsession.h"
 
 #include <QApplication>
 #include <QToolButton>
@@ -8,13 +11,17 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QMenu>
+#include <QActionGroup>
 #include <QTabWidget>
 #include <QStatusBar>
 #include <QShortcut>
 #include <QFileInfo>
 #include <QDockWidget>
 #include <QLineEdit>
+#include <QComboBox>
+#include <QSpinBox>
 #include <QListWidget>
+#include <QListView>
 #include <QFrame>
 
 void MainWindow::setupUI()
@@ -127,25 +134,41 @@ void MainWindow::createActions()
     m_goToPageAction = new QAction(QStringLiteral("&Go to Page..."), this);
     m_toggleStatusBarAction = new QAction(QStringLiteral("Toggle Status &Bar"), this);
     m_toggleStatusBarAction->setCheckable(true);
-    m_invertColorsAction = new QAction(QStringLiteral("&Invert Page Colors\tCtrl+I"), this);
-    m_invertColorsAction->setShortcut(QKeySequence("Ctrl+I"));
-    m_invertColorsAction->setCheckable(true);
+    m_pageColorsMenu = new QMenu(QStringLiteral("Page &Colors"), this);
+    m_colorModeGroup = new QActionGroup(this);
+    auto addColorMode = [this](const QString& text, ColorMode mode) {
+        QAction* action = m_pageColorsMenu->addAction(text);
+        action->setCheckable(true);
+        action->setData(int(mode));
+        m_colorModeGroup->addAction(action);
+        connect(action, &QAction::triggered, this, [this, mode] { setColorMode(mode); });
+    };
+    addColorMode(QStringLiteral("&Normal"), ColorMode::Normal);
+    addColorMode(QStringLiteral("&Inverted\tCtrl+I"), ColorMode::Invert);
+    addColorMode(QStringLiteral("&Sepia"), ColorMode::Sepia);
+    addColorMode(QStringLiteral("&Custom"), ColorMode::Custom);
+    m_pageColorsMenu->addSeparator();
+    QAction* customColorsAction = m_pageColorsMenu->addAction(QStringLiteral("Choose Custom Colors..."));
     m_exitAction = new QAction(QStringLiteral("E&xit"), this);
     QAction* setNotesDirAction = new QAction(QStringLiteral("Set Notes Directory..."), this);
+    QAction* setLibraryFolderAction = new QAction(QStringLiteral("Set Library Folder..."), this);
+    QAction* exportAction = new QAction(QStringLiteral("&Export As..."), this);
 
 
     m_mainMenu->addAction(m_openAction);
     m_recentFilesMenu = m_mainMenu->addMenu(QStringLiteral("Open &Recent"));
     m_favoritesMenu = m_mainMenu->addMenu(QStringLiteral("&Favorites"));
+    m_mainMenu->addAction(exportAction);
     m_mainMenu->addSeparator();
     m_mainMenu->addAction(m_tocAction);
     m_mainMenu->addAction(m_notesAction);
     m_mainMenu->addAction(m_searchAction);
     m_mainMenu->addAction(m_goToPageAction);
     m_mainMenu->addSeparator();
-    m_mainMenu->addAction(m_invertColorsAction);
+    m_mainMenu->addMenu(m_pageColorsMenu);
     m_mainMenu->addAction(m_toggleStatusBarAction);
     m_mainMenu->addAction(setNotesDirAction);
+    m_mainMenu->addAction(setLibraryFolderAction);
     m_mainMenu->addSeparator();
     m_mainMenu->addAction(m_exitAction);
 
@@ -156,6 +179,8 @@ void MainWindow::createActions()
     connect(m_tocAction, &QAction::triggered, this, &MainWindow::showTableOfContents);
     connect(m_notesAction, &QAction::triggered, this, &MainWindow::showNotes);
     connect(setNotesDirAction, &QAction::triggered, this, &MainWindow::setNotesDirectory);
+    connect(setLibraryFolderAction, &QAction::triggered, this, &MainWindow::setLibraryFolder);
+    connect(exportAction, &QAction::triggered, this, &MainWindow::exportDocument);
     connect(m_searchAction, &QAction::triggered, this, [this](){
         m_searchDockWidget->show();
         m_searchInput->setFocus();
@@ -164,13 +189,11 @@ void MainWindow::createActions()
     connect(m_goToPageAction, &QAction::triggered, this, &MainWindow::promptForPageNumber);
     connect(m_copyAction, &QAction::triggered, this, [this] {
         if (m_lastSelectionRect.isValid()) {
-            Document* doc = m_documents.at(m_tabWidget->currentIndex());
-            QString selectedText = doc->getSelectedText(m_lastSelectionRect, m_settings.zoomFactor);
-            copySelection(selectedText);
+            copySelection(selectedText());
         }
     });
     connect(m_toggleStatusBarAction, &QAction::triggered, this, &MainWindow::toggleStatusBar);
-    connect(m_invertColorsAction, &QAction::triggered, this, &MainWindow::invertPageColors);
+    connect(customColorsAction, &QAction::triggered, this, &MainWindow::chooseCustomPageColors);
     connect(m_exitAction, &QAction::triggered, this, &MainWindow::close);
 
     new QShortcut(QKeySequence::Open, this, SLOT(openFile()));
@@ -182,6 +205,7 @@ void MainWindow::createActions()
     new QShortcut(QKeySequence(Qt::CTRL | Qt::Key_H), this, SLOT(onSavePassageShortcut()));
     new QShortcut(QKeySequence(Qt::CTRL | Qt::Key_J), this, SLOT(onSaveCommentShortcut()));
     new QShortcut(QKeySequence(Qt::CTRL | Qt::Key_K), this, SLOT(onSavePageNoteShortcut()));
+    new QShortcut(QKeySequence(Qt::CTRL | Qt::Key_I), this, SLOT(invertPageColors()));
 
     auto* zoomInShortcut = new QShortcut(this);
     zoomInShortcut->setKey(Qt::CTRL | Qt::Key_Equal);
@@ -221,6 +245,7 @@ void MainWindow::setupTheme()
         QToolButton#dockWidgetCloseButton { font-weight: bold; }
         QPushButton#searchNavButton { background-color: transparent; color: white; border: 1px solid #555555; padding: 2px; min-width: 25px; }
         QPushButton#searchNavButton:hover { background-color: #3a3a3a; border-color: #777777; }
+        QPushButton#searchNavButton:checked { background-color: #555555; border-color: #999999; }
         QMenu { background-color: #2a2a2a; color: white; }
         QMenu::item:selected { background-color: #444444; }
         #customTitleBar { background-color: #2a2a2a; }
@@ -258,6 +283,27 @@ void MainWindow::createSearchDockWidget()
     m_searchInput->setPlaceholderText(QStringLiteral("Search document..."));
     inputLayout->addWidget(m_searchInput);
 
+    m_searchModeCombo = new QComboBox;
+    m_searchModeCombo->addItem(QStringLiteral("Text"), SearchQuery::Literal);
+    m_searchModeCombo->addItem(QStringLiteral("Whole word"), SearchQuery::WholeWord);
+    m_searchModeCombo->addItem(QStringLiteral("Regex"), SearchQuery::Regex);
+    m_searchModeCombo->addItem(QStringLiteral("AND / OR / NEAR"), SearchQuery::Boolean);
+    m_searchModeCombo->addItem(QStringLiteral("Fuzzy"), SearchQuery::Fuzzy);
+    m_searchModeCombo->setToolTip(QStringLiteral("Boolean queries: words are ANDed, OR separates alternatives, \"quoted phrases\", a NEAR/5 b"));
+    inputLayout->addWidget(m_searchModeCombo);
+
+    m_fuzzyDistanceSpin = new QSpinBox;
+    m_fuzzyDistanceSpin->setRange(1, 5);
+    m_fuzzyDistanceSpin->setToolTip(QStringLiteral("Typos allowed per match"));
+    m_fuzzyDistanceSpin->setVisible(false);
+    inputLayout->addWidget(m_fuzzyDistanceSpin);
+
+    m_matchDiacriticsButton = new QPushButton(QStringLiteral("\u00E1"));
+    m_matchDiacriticsButton->setObjectName(QStringLiteral("searchNavButton"));
+    m_matchDiacriticsButton->setCheckable(true);
+    m_matchDiacriticsButton->setToolTip(QStringLiteral("Match diacritics (\u00E9 does not find e)"));
+    inputLayout->addWidget(m_matchDiacriticsButton);
+
     QPushButton* prevButton = new QPushButton(QStringLiteral("\u25B2"));
     prevButton->setObjectName(QStringLiteral("searchNavButton"));
     prevButton->setToolTip(QStringLiteral("Previous result"));
@@ -268,18 +314,62 @@ void MainWindow::createSearchDockWidget()
     nextButton->setToolTip(QStringLiteral("Next result"));
     inputLayout->addWidget(nextButton);
 
-    m_searchResultsList = new QListWidget;
+    m_searchScopeCombo = new QComboBox;
+    m_searchScopeCombo->addItem(QStringLiteral("This document"), CurrentDocumentScope);
+    m_searchScopeCombo->addItem(QStringLiteral("All open tabs"), OpenTabsScope);
+    m_searchScopeCombo->addItem(QStringLiteral("Open tabs and library folder"), LibraryScope);
+
+    m_searchResults = new SearchResultsModel(this);
+    m_searchResultsView = new QListView;
+    m_searchResultsView->setUniformItemSizes(true);
+    m_searchResultsView->setModel(m_searchResults);
 
     mainLayout->addLayout(inputLayout);
-    mainLayout->addWidget(m_searchResultsList);
+    mainLayout->addWidget(m_searchScopeCombo);
+    mainLayout->addWidget(m_searchResultsView);
     m_searchDockWidget->setWidget(searchWidget);
 
     addDockWidget(Qt::RightDockWidgetArea, m_searchDockWidget);
     m_searchDockWidget->hide();
 
-    connect(m_searchInput, &QLineEdit::returnPressed, this, [this](){ executeSearch(m_searchInput->text()); });
+    // Search as the user types, once they pause; Return searches straight away.
+    m_searchDebounceTimer = new QTimer(this);
+    m_searchDebounceTimer->setSingleShot(true);
+    m_searchDebounceTimer->setInterval(250);
+    connect(m_searchDebounceTimer, &QTimer::timeout, this, [this](){ executeSearch(m_searchInput->text()); });
+    connect(m_searchInput, &QLineEdit::textEdited, this, [this](){
+        // The running search is stale from the first keystroke, so it stops here
+        // rather than competing with the one the pause will start.
+        if (m_searchSession) m_searchSession->cancel();
+        m_searchDebounceTimer->start();
+    });
+    connect(m_searchInput, &QLineEdit::returnPressed, this, [this](){
+        m_searchDebounceTimer->stop();
+        executeSearch(m_searchInput->text());
+    });
+    connect(m_searchModeCombo, &QComboBox::currentIndexChanged, this, [this](){
+        m_fuzzyDistanceSpin->setVisible(m_searchModeCombo->currentData().toInt() == SearchQuery::Fuzzy);
+        m_searchDebounceTimer->stop();
+        executeSearch(m_searchInput->text());
+    });
+    connect(m_fuzzyDistanceSpin, &QSpinBox::valueChanged, this, [this](int distance){
+        m_settings.fuzzySearchDistance = distance;
+        m_searchDebounceTimer->start();
+    });
+    connect(m_matchDiacriticsButton, &QPushButton::toggled, this, [this](bool checked){
+        m_settings.matchDiacritics = checked;
+        m_searchDebounceTimer->stop();
+        executeSearch(m_searchInput->text());
+    });
+    connect(m_searchScopeCombo, &QComboBox::currentIndexChanged, this, [this](){
+        if (searchScope() == LibraryScope && m_settings.libraryFolder.isEmpty()) {
+            setLibraryFolder();
+        }
+        m_searchDebounceTimer->stop();
+        executeSearch(m_searchInput->text());
+    });
     connect(prevButton, &QPushButton::clicked, this, &MainWindow::findPrevSearchResult);
     connect(nextButton, &QPushButton::clicked, this, &MainWindow::findNextSearchResult);
-    connect(m_searchResultsList, &QListWidget::itemClicked, this, &MainWindow::onSearchResultClicked);
-    connect(m_searchResultsList, &QListWidget::currentItemChanged, this, &MainWindow::onSearchResultChanged);
+    connect(m_searchResultsView, &QListView::clicked, this, &MainWindow::onSearchResultActivated);
+    connect(m_searchResultsView->selectionModel(), &QItemSelectionModel::currentChanged, this, &MainWindow::onSearchResultActivated);
 }
@@ -0,0 +1,131 @@
+#include "notesfile.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QDebug>
+#include <algorithm>
+
+static const int TailCheckSize = 64;
+
+NotesFile::NotesFile(const QString& path)
+    : m_path(path)
+{
+}
+
+QString NotesFile::path() const
+{
+    return m_path;
+}
+
+const QVector<Note>& NotesFile::notes()
+{
+    refresh();
+    return m_notes;
+}
+
+void NotesFile::reset()
+{
+    m_size = -1;
+    m_modified = QDateTime();
+    m_tail.clear();
+    m_notes.clear();
+}
+
+void NotesFile::refresh()
+{
+    const QFileInfo info(m_path);
+    if (!info.exists()) {
+        reset();
+        return;
+    }
+    const qint64 size = info.size();
+    const QDateTime modified = info.lastModified();
+    if (size == m_size && modified == m_modified) return;
+
+    QFile file(m_path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to read notes file" << m_path << ":" << file.errorString();
+        reset();
+        return;
+    }
+
+    // Grown, with the bytes that used to end the file still in place: the old notes
+    // stand, except that the last one may have been continued.
+    bool appended = false;
+    if (m_size > 0 && size > m_size && file.seek(m_size - m_tail.size())) {
+        appended = file.read(m_tail.size()) == m_tail;
+    }
+
+    qint64 from = 0;
+    if (appended && !m_notes.isEmpty()) {
+        from = m_notes.last().filePos;
+        m_notes.removeLast();
+    } else {
+        m_notes.clear();
+    }
+    if (!file.seek(from)) {
+        reset();
+        return;
+    }
+    const QByteArray content = file.readAll();
+    m_notes += parse(content, from);
+
+    m_size = from + content.size();
+    m_modified = modified;
+    if (content.size() >= TailCheckSize || from == 0) {
+        m_tail = content.right(TailCheckSize);
+    } else if (file.seek(std::max<qint64>(0, m_size - TailCheckSize))) {
+        m_tail = file.read(m_size - file.pos());
+    }
+}
+
+QVector<Note> NotesFile::parse(const QByteArray& content, qint64 baseOffset)
+{
+    QVector<Note> notes;
+
+    // Headers are ASCII, so they are matched in a Latin-1 view of the bytes, where
+    // every offset is a byte offset; only the note bodies are decoded as UTF-8.
+    static const QRegularExpression headerRegex(R"((?:\r?\n){2}Page (\d+)( NOTE)? \((.*?)\)(?: \[([\d\.-]+),([\d\.-]+),([\d\.-]+),([\d\.-]+)\])?\r?\n)");
+    const QString bytes = QString::fromLatin1(content);
+    QRegularExpressionMatchIterator i = headerRegex.globalMatch(bytes);
+    QVector<QRegularExpressionMatch> matches;
+    while (i.hasNext()) {
+        matches.append(i.next());
+    }
+
+    for (int j = 0; j < matches.size(); ++j) {
+        const QRegularExpressionMatch& match = matches[j];
+        Note note;
+        note.filePos = baseOffset + match.capturedStart();
+        note.pageNum = match.captured(1).toInt();
+        note.dateTime = match.captured(3);
+
+        if (!match.captured(4).isNull()) {
+            note.location = QRectF(match.captured(4).toDouble(), match.captured(5).toDouble(),
+                                   match.captured(6).toDouble(), match.captured(7).toDouble());
+        }
+
+        const qint64 contentStart = match.capturedEnd();
+        const qint64 contentEnd = (j + 1 < matches.size()) ? matches[j + 1].capturedStart() : content.size();
+        note.fileEndPos = baseOffset + contentEnd;
+
+        QString noteBody = QString::fromUtf8(content.mid(contentStart, contentEnd - contentStart));
+        noteBody.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+        noteBody = noteBody.trimmed();
+
+        if (!match.captured(2).isEmpty()) {
+            note.type = Note::PageNote;
+            note.content = noteBody;
+        } else if (noteBody.contains("\n\nCOMMENT: ")) {
+            note.type = Note::Comment;
+            note.content = noteBody.section("\n\nCOMMENT: ", 0, 0);
+            note.comment = noteBody.section("\n\nCOMMENT: ", 1, 1);
+        } else {
+            note.type = Note::Passage;
+            note.content = noteBody;
+        }
+        notes.append(note);
+    }
+    return notes;
+}
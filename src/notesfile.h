@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QRectF>
+#include <QDateTime>
+#include <QMetaType>
+
+struct Note {
+    enum NoteType { Passage, Comment, PageNote };
+    NoteType type;
+    int pageNum = -1;
+    QString dateTime;
+    QString content;
+    QString comment;
+    QRectF location;
+    // Byte offsets of the note in the file, from the blank line before its header
+    // to the start of the next note's.
+    qint64 filePos = -1;
+    qint64 fileEndPos = -1;
+};
+Q_DECLARE_METATYPE(Note)
+
+// The parsed notes of one _NOTES.txt file, kept in step with the file. Looking at
+// the notes again costs a stat while the file's size and modification time are
+// unchanged; when it only grew, as it does whenever a passage, comment or page note
+// is saved, just the last note and what follows it are parsed again. Anything else
+// rereads the whole file. Line endings may be LF or CRLF.
+class NotesFile
+{
+public:
+    NotesFile() = default;
+    explicit NotesFile(const QString& path);
+
+    QString path() const;
+    const QVector<Note>& notes();
+
+    static QVector<Note> parse(const QByteArray& content, qint64 baseOffset = 0);
+
+private:
+    void refresh();
+    void reset();
+
+    QString m_path;
+    qint64 m_size = -1;
+    QDateTime m_modified;
+    QByteArray m_tail;          // the file's last bytes, to tell an append from a rewrite
+    QVector<Note> m_notes;
+};
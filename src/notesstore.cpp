@@ -0,0 +1,315 @@
+#include "notesstore.h"
+
+#include <QtConcurrent>
+#include <QTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <algorithm>
+
+static const char JournalMagic[] = "ERNOTES-JOURNAL";
+static const int JournalVersion = 1;
+static const int CompactionDelayMs = 2000;
+
+// The header names the .txt the records apply to: its size when the journal was
+// started and a hash of those bytes. Later appends don't change either.
+static QByteArray baseFingerprint(QFile& base, qint64 size)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!base.seek(0)) return QByteArray();
+    qint64 remaining = size;
+    while (remaining > 0) {
+        const QByteArray chunk = base.read(std::min<qint64>(remaining, 64 * 1024));
+        if (chunk.isEmpty()) return QByteArray();
+        hash.addData(chunk);
+        remaining -= chunk.size();
+    }
+    return hash.result().toHex();
+}
+
+NotesStore::NotesStore(const QString& path, QObject* parent)
+    : QObject(parent),
+    m_path(path),
+    m_journalPath(path + ".journal"),
+    m_base(path),
+    m_compactionTimer(new QTimer(this))
+{
+    m_compactionTimer->setSingleShot(true);
+    m_compactionTimer->setInterval(CompactionDelayMs);
+    connect(m_compactionTimer, &QTimer::timeout, this, [this] {
+        if (m_compaction.isRunning()) {
+            m_compactionTimer->start();
+            return;
+        }
+        m_compaction = QtConcurrent::run([this] { compact(); });
+    });
+
+    loadJournal();
+    if (!m_edits.isEmpty()) scheduleCompaction();
+}
+
+NotesStore::~NotesStore()
+{
+    m_compactionTimer->stop();
+    m_compaction.waitForFinished();
+    if (!m_edits.isEmpty()) compact();
+}
+
+QString NotesStore::path() const
+{
+    return m_path;
+}
+
+QVector<Note> NotesStore::notes()
+{
+    QMutexLocker locker(&m_mutex);
+    return currentNotes();
+}
+
+QVector<Note> NotesStore::currentNotes()
+{
+    const QVector<Note>& base = m_base.notes();
+    if (m_edits.isEmpty()) return base;
+
+    // An edited note keeps the byte range of the note it replaced, which is what
+    // further edits of it are recorded against.
+    QVector<Note> notes;
+    notes.reserve(base.size());
+    for (const Note& note : base) {
+        const auto edit = m_edits.constFind(note.filePos);
+        if (edit == m_edits.cend()) {
+            notes.append(note);
+        } else if (!edit->removed) {
+            for (Note replacement : NotesFile::parse(edit->block)) {
+                replacement.filePos = note.filePos;
+                replacement.fileEndPos = note.fileEndPos;
+                notes.append(replacement);
+            }
+        }
+    }
+    return notes;
+}
+
+const Note* NotesStore::locate(const QVector<Note>& notes, const Note& note) const
+{
+    auto sameNote = [&note](const Note& other) {
+        return other.type == note.type && other.pageNum == note.pageNum && other.dateTime == note.dateTime;
+    };
+    for (const Note& other : notes) {
+        if (other.filePos == note.filePos && sameNote(other)) return &other;
+    }
+    for (const Note& other : notes) {
+        if (sameNote(other) && other.content == note.content && other.comment == note.comment) return &other;
+    }
+    return nullptr;
+}
+
+bool NotesStore::append(const QString& block)
+{
+    QMutexLocker locker(&m_mutex);
+    QFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qWarning() << "Failed to append to notes file" << m_path << ":" << file.errorString();
+        return false;
+    }
+    QTextStream out(&file);
+    out << block;
+    out.flush();
+    return out.status() == QTextStream::Ok;
+}
+
+bool NotesStore::replace(const Note& note, const QString& block)
+{
+    QMutexLocker locker(&m_mutex);
+    const QVector<Note> notes = currentNotes();
+    const Note* target = locate(notes, note);
+    if (!target) return false;
+
+    // The new block takes the line endings of the note it replaces.
+    QByteArray bytes = block.toUtf8();
+    QFile base(m_path);
+    if (base.open(QIODevice::ReadOnly) && base.seek(target->filePos) && base.read(2) == "\r\n") {
+        bytes.replace("\r\n", "\n");
+        bytes.replace("\n", "\r\n");
+    }
+
+    const QByteArray record = QStringLiteral("R %1 %2 %3\n").arg(target->filePos).arg(target->fileEndPos).arg(bytes.size()).toLatin1()
+        + bytes + '\n';
+    if (!appendRecord(record)) return false;
+    m_edits.insert(target->filePos, { target->fileEndPos, false, bytes });
+    ++m_editCount;
+    scheduleCompaction();
+    return true;
+}
+
+bool NotesStore::remove(const Note& note)
+{
+    QMutexLocker locker(&m_mutex);
+    const QVector<Note> notes = currentNotes();
+    const Note* target = locate(notes, note);
+    if (!target) return false;
+
+    const QByteArray record = QStringLiteral("D %1 %2\n").arg(target->filePos).arg(target->fileEndPos).toLatin1();
+    if (!appendRecord(record)) return false;
+    m_edits.insert(target->filePos, { target->fileEndPos, true, QByteArray() });
+    ++m_editCount;
+    scheduleCompaction();
+    return true;
+}
+
+void NotesStore::loadJournal()
+{
+    QFile journal(m_journalPath);
+    if (!journal.exists()) return;
+    if (!journal.open(QIODevice::ReadWrite)) {
+        qWarning() << "Failed to open notes journal" << m_journalPath << ":" << journal.errorString();
+        return;
+    }
+
+    const QList<QByteArray> header = journal.readLine().trimmed().split(' ');
+    QFile base(m_path);
+    bool valid = header.size() == 4 && header[0] == JournalMagic && header[1].toInt() == JournalVersion
+        && base.open(QIODevice::ReadOnly);
+    if (valid) {
+        const qint64 baseSize = header[2].toLongLong(&valid);
+        valid = valid && base.size() >= baseSize && baseFingerprint(base, baseSize) == header[3];
+    }
+    if (!valid) {
+        qWarning() << "Discarding notes journal that doesn't match" << m_path;
+        journal.remove();
+        return;
+    }
+
+    // A record cut short by a crash ends the journal; it is trimmed off so new
+    // records aren't appended behind it.
+    QMap<qint64, Edit> edits;
+    qint64 validEnd = journal.pos();
+    while (!journal.atEnd()) {
+        const QByteArray line = journal.readLine();
+        if (!line.endsWith('\n')) break;
+        const QList<QByteArray> fields = line.trimmed().split(' ');
+        bool ok = fields.size() >= 3;
+        const qint64 pos = ok ? fields[1].toLongLong(&ok) : 0;
+        const qint64 end = ok ? fields[2].toLongLong(&ok) : 0;
+        if (!ok || pos < 0 || end < pos) break;
+
+        if (fields[0] == "D" && fields.size() == 3) {
+            edits.insert(pos, { end, true, QByteArray() });
+        } else if (fields[0] == "R" && fields.size() == 4) {
+            const qint64 length = fields[3].toLongLong(&ok);
+            if (!ok || length < 0) break;
+            const QByteArray block = journal.read(length);
+            if (block.size() != length || journal.read(1) != "\n") break;
+            edits.insert(pos, { end, false, block });
+        } else {
+            break;
+        }
+        validEnd = journal.pos();
+    }
+    if (validEnd < journal.size()) {
+        qWarning() << "Dropping incomplete record at the end of" << m_journalPath;
+        journal.resize(validEnd);
+    }
+    m_edits = edits;
+}
+
+bool NotesStore::appendRecord(const QByteArray& record)
+{
+    QFile journal(m_journalPath);
+    const bool fresh = !journal.exists() || journal.size() == 0;
+    QByteArray bytes;
+    if (fresh) {
+        QFile base(m_path);
+        if (!base.open(QIODevice::ReadOnly)) {
+            qWarning() << "Failed to read notes file" << m_path << ":" << base.errorString();
+            return false;
+        }
+        const qint64 baseSize = base.size();
+        bytes = QStringLiteral("%1 %2 %3 ").arg(QLatin1String(JournalMagic)).arg(JournalVersion).arg(baseSize).toLatin1()
+            + baseFingerprint(base, baseSize) + '\n';
+    }
+    bytes += record;
+
+    if (!journal.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Failed to write notes journal" << m_journalPath << ":" << journal.errorString();
+        return false;
+    }
+    const bool written = journal.write(bytes) == bytes.size() && journal.flush();
+    if (!written) {
+        qWarning() << "Failed to write notes journal" << m_journalPath << ":" << journal.errorString();
+    }
+    return written;
+}
+
+void NotesStore::scheduleCompaction()
+{
+    // Each further change pushes the rewrite back, so a burst of edits costs one.
+    m_compactionTimer->start();
+}
+
+// The .txt is read and rewritten without the lock, so the GUI thread can go on
+// listing, adding and editing notes meanwhile. Only the commit is done under it,
+// and only if nothing was appended or journaled since the edits were taken;
+// otherwise the rewrite is thrown away and done again from the new state.
+void NotesStore::compact()
+{
+    for (;;) {
+        QMap<qint64, Edit> edits;
+        quint64 editCount;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_edits.isEmpty()) return;
+            edits = m_edits;
+            editCount = m_editCount;
+        }
+
+        QFile base(m_path);
+        if (!base.open(QIODevice::ReadOnly)) {
+            qWarning() << "Failed to read notes file" << m_path << ":" << base.errorString();
+            return;
+        }
+        const QByteArray content = base.readAll();
+        base.close();
+
+        QByteArray compacted;
+        compacted.reserve(content.size());
+        qint64 cursor = 0;
+        for (auto edit = edits.cbegin(); edit != edits.cend(); ++edit) {
+            if (edit.key() < cursor || edit->end > content.size()) {
+                qWarning() << "Notes journal out of step with" << m_path << "- not compacting";
+                return;
+            }
+            compacted += content.mid(cursor, edit.key() - cursor);
+            if (!edit->removed) compacted += edit->block;
+            cursor = edit->end;
+        }
+        compacted += content.mid(cursor);
+
+        QSaveFile out(m_path);
+        if (!out.open(QIODevice::WriteOnly) || out.write(compacted) != compacted.size()) {
+            qWarning() << "Failed to compact notes file" << m_path << ":" << out.errorString();
+            return;
+        }
+
+        QMutexLocker locker(&m_mutex);
+        // Appends only ever grow the .txt, so its size tells whether one landed.
+        if (m_editCount != editCount || QFileInfo(m_path).size() != content.size()) {
+            out.cancelWriting();
+            continue;
+        }
+        if (!out.commit()) {
+            qWarning() << "Failed to compact notes file" << m_path << ":" << out.errorString();
+            return;
+        }
+
+        // The new .txt is in place; the journal no longer matches it either way.
+        QFile::remove(m_journalPath);
+        m_edits.clear();
+        // Offsets moved, which NotesFile can't tell from an append.
+        m_base = NotesFile(m_path);
+        return;
+    }
+}
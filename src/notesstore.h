@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QMap>
+#include <QMutex>
+#include <QFuture>
+
+#include "notesfile.h"
+
+class QTimer;
+
+// Owns a book's _NOTES.txt. New notes are appended to the file as before. Edits
+// and deletes don't rewrite it: each one is a small record appended to a journal
+// next to it (_NOTES.txt.journal), naming the byte range of the note in the .txt
+// it replaces or removes. notes() reads the .txt through NotesFile and overlays
+// the journal. A couple of seconds after the last change the journal is folded
+// into the .txt on the global thread pool, written through QSaveFile, and only then
+// removed. A crash at any point leaves either the old .txt with its journal or the
+// new .txt. The journal's header fingerprints the .txt it applies to, so a journal
+// left beside a .txt that was replaced or edited by hand is discarded, not misapplied.
+// Changes are made from the GUI thread; only compaction runs elsewhere.
+class NotesStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit NotesStore(const QString& path, QObject* parent = nullptr);
+    // Waits for a running compaction and folds in whatever is still journaled, so
+    // the .txt is complete once the store is gone.
+    ~NotesStore();
+    NotesStore(const NotesStore&) = delete;
+    NotesStore& operator=(const NotesStore&) = delete;
+
+    QString path() const;
+    QVector<Note> notes();
+
+    // block is a complete note in the file's format, starting with its blank line.
+    bool append(const QString& block);
+    // The note is found again by position, or else by its contents, so a note from
+    // a list shown before a compaction moved things still resolves.
+    bool replace(const Note& note, const QString& block);
+    bool remove(const Note& note);
+
+private:
+    struct Edit {
+        qint64 end;
+        bool removed;
+        QByteArray block;
+    };
+
+    QVector<Note> currentNotes();
+    const Note* locate(const QVector<Note>& notes, const Note& note) const;
+    void loadJournal();
+    bool appendRecord(const QByteArray& record);
+    void scheduleCompaction();
+    void compact();
+
+    QString m_path;
+    QString m_journalPath;
+    QMutex m_mutex;
+    NotesFile m_base;
+    QMap<qint64, Edit> m_edits;     // by the note's byte offset in the .txt
+    quint64 m_editCount = 0;        // tells compaction the edits changed under it
+    QTimer* m_compactionTimer;
+    QFuture<void> m_compaction;
+};
@@ -0,0 +1,112 @@
+#include "pagecache.h"
+#include <iterator>
+
+PageCache::PageCache(qint64 maxBytes)
+    : m_maxBytes(maxBytes),
+    m_totalBytes(0),
+    m_activeDocument(0)
+{
+}
+
+void PageCache::setMaxBytes(qint64 maxBytes)
+{
+    m_maxBytes = maxBytes;
+    trim();
+}
+
+qint64 PageCache::maxBytes() const { return m_maxBytes; }
+qint64 PageCache::totalBytes() const { return m_totalBytes; }
+qint64 PageCache::documentBytes(quint32 documentId) const { return m_documentBytes.value(documentId); }
+PageCache::Stats PageCache::stats() const { return m_stats; }
+
+void PageCache::setActiveDocument(quint32 documentId)
+{
+    m_activeDocument = documentId;
+}
+
+QImage PageCache::find(const PageKey& key)
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        ++m_stats.misses;
+        return QImage();
+    }
+    ++m_stats.hits;
+    m_lru.splice(m_lru.begin(), m_lru, it->lruPos);
+    return it->image;
+}
+
+bool PageCache::contains(const PageKey& key) const
+{
+    return m_entries.contains(key);
+}
+
+void PageCache::insert(const PageKey& key, const QImage& image)
+{
+    if (image.isNull()) return;
+
+    auto existing = m_entries.find(key);
+    if (existing != m_entries.end()) {
+        remove(existing);
+    }
+
+    const qint64 cost = image.sizeInBytes();
+    if (cost > m_maxBytes) return;
+
+    m_lru.push_front(key);
+    m_entries.insert(key, { image, cost, m_lru.begin() });
+    m_documentBytes[key.documentId] += cost;
+    m_totalBytes += cost;
+    trim();
+}
+
+void PageCache::removeDocument(quint32 documentId)
+{
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (it.key().documentId == documentId) {
+            m_totalBytes -= it->cost;
+            m_lru.erase(it->lruPos);
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_documentBytes.remove(documentId);
+}
+
+void PageCache::clear()
+{
+    m_entries.clear();
+    m_lru.clear();
+    m_documentBytes.clear();
+    m_totalBytes = 0;
+}
+
+void PageCache::remove(QHash<PageKey, Entry>::iterator it)
+{
+    const quint32 documentId = it.key().documentId;
+    m_totalBytes -= it->cost;
+    qint64& documentBytes = m_documentBytes[documentId];
+    documentBytes -= it->cost;
+    if (documentBytes <= 0) {
+        m_documentBytes.remove(documentId);
+    }
+    m_lru.erase(it->lruPos);
+    m_entries.erase(it);
+}
+
+void PageCache::trim()
+{
+    // First pass spares the active document; the second falls back to plain LRU.
+    for (int pass = 0; pass < 2 && m_totalBytes > m_maxBytes; ++pass) {
+        auto pos = m_lru.end();
+        while (m_totalBytes > m_maxBytes && pos != m_lru.begin()) {
+            --pos;
+            if (pass == 0 && pos->documentId == m_activeDocument) continue;
+            auto victim = m_entries.find(*pos);
+            pos = std::next(pos);
+            remove(victim);
+            ++m_stats.evictions;
+        }
+    }
+}
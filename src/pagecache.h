@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QHash>
+#include <QImage>
+#include <list>
+
+struct PageKey {
+    quint32 documentId = 0;
+    int pageNum = -1;
+    int zoomPercent = 0;
+    int tileX = -1;
+    int tileY = -1;
+
+    bool operator==(const PageKey& other) const
+    {
+        return documentId == other.documentId && pageNum == other.pageNum
+            && zoomPercent == other.zoomPercent
+            && tileX == other.tileX && tileY == other.tileY;
+    }
+};
+
+inline size_t qHash(const PageKey& key, size_t seed = 0)
+{
+    return qHashMulti(seed, key.documentId, key.pageNum, key.zoomPercent, key.tileX, key.tileY);
+}
+
+// LRU cache of rendered page images and tiles, costed in bytes. Memory is tracked
+// per document so a closed tab can be purged in one call, and when the budget is
+// exceeded pages of background documents are evicted before the active one's.
+class PageCache
+{
+public:
+    struct Stats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        quint64 evictions = 0;
+    };
+
+    explicit PageCache(qint64 maxBytes = 100 * 1024 * 1024);
+
+    void setMaxBytes(qint64 maxBytes);
+    qint64 maxBytes() const;
+    qint64 totalBytes() const;
+    qint64 documentBytes(quint32 documentId) const;
+    void setActiveDocument(quint32 documentId);
+
+    // Returns a null image on a miss. Lookups count towards the statistics and
+    // refresh the entry's position in the LRU; contains() does neither.
+    QImage find(const PageKey& key);
+    bool contains(const PageKey& key) const;
+    void insert(const PageKey& key, const QImage& image);
+    void removeDocument(quint32 documentId);
+    void clear();
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        QImage image;
+        qint64 cost;
+        std::list<PageKey>::iterator lruPos;
+    };
+
+    void remove(QHash<PageKey, Entry>::iterator it);
+    void trim();
+
+    QHash<PageKey, Entry> m_entries;
+    std::list<PageKey> m_lru;
+    QHash<quint32, qint64> m_documentBytes;
+    qint64 m_maxBytes;
+    qint64 m_totalBytes;
+    quint32 m_activeDocument;
+    Stats m_stats;
+};
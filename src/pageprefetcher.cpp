@@ -0,0 +1,52 @@
+#include "pageprefetcher.h"
+#include <algorithm>
+#include <cmath>
+
+static const int MaxPagesAhead = 6;
+static const double MsPerExtraPage = 150.0;
+
+PagePrefetcher::PagePrefetcher()
+    : m_avgRenderMs(0.0)
+{
+}
+
+void PagePrefetcher::recordRender(const Document* doc, qint64 renderMs, qint64 imageBytes)
+{
+    // Exponential moving average so one pathological page doesn't dominate.
+    m_avgRenderMs = (m_avgRenderMs == 0.0) ? renderMs : (m_avgRenderMs * 0.8 + renderMs * 0.2);
+    m_states[doc].imageBytes = imageBytes;
+}
+
+QVector<int> PagePrefetcher::plan(const Document* doc, int currentPage, int pageCount, qint64 freeCacheBytes)
+{
+    DocState& state = m_states[doc];
+    if (state.lastPage >= 0 && currentPage != state.lastPage) {
+        state.direction = (currentPage > state.lastPage) ? 1 : -1;
+    }
+    state.lastPage = currentPage;
+
+    int ahead = std::clamp(1 + static_cast<int>(std::ceil(m_avgRenderMs / MsPerExtraPage)), 1, MaxPagesAhead);
+    if (state.imageBytes > 0) {
+        // Leave room for one page behind as well as the look-ahead.
+        qint64 affordable = freeCacheBytes / state.imageBytes - 1;
+        ahead = static_cast<int>(std::min<qint64>(ahead, affordable));
+    }
+
+    QVector<int> pages;
+    for (int i = 1; i <= ahead; ++i) {
+        int page = currentPage + i * state.direction;
+        if (page < 0 || page >= pageCount) break;
+        pages.append(page);
+    }
+
+    int behind = currentPage - state.direction;
+    if (ahead >= 0 && behind >= 0 && behind < pageCount) {
+        pages.append(behind);
+    }
+    return pages;
+}
+
+void PagePrefetcher::forget(const Document* doc)
+{
+    m_states.remove(doc);
+}
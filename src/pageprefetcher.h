@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QHash>
+#include <QVector>
+
+class Document;
+
+// Decides which neighbouring pages to render ahead of the reader. The look-ahead
+// grows when pages are slow to render and shrinks when the page cache has little
+// room left, so prefetching never evicts the pages the user is looking at.
+class PagePrefetcher
+{
+public:
+    PagePrefetcher();
+
+    void recordRender(const Document* doc, qint64 renderMs, qint64 imageBytes);
+    QVector<int> plan(const Document* doc, int currentPage, int pageCount, qint64 freeCacheBytes);
+    void forget(const Document* doc);
+
+private:
+    struct DocState {
+        int lastPage = -1;
+        int direction = 1;
+        qint64 imageBytes = 0;
+    };
+
+    QHash<const Document*, DocState> m_states;
+    double m_avgRenderMs;
+};
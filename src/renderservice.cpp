@@ -0,0 +1,213 @@
+#include "renderservice.h"
+#include "document.h"
+
+#include <QtConcurrent>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <algorithm>
+
+static void lockMupdf(void* user, int lock)
+{
+    static_cast<QMutex*>(user)[lock].lock();
+}
+
+static void unlockMupdf(void* user, int lock)
+{
+    static_cast<QMutex*>(user)[lock].unlock();
+}
+
+static bool isSamePage(const RenderRequest& a, const RenderRequest& b)
+{
+    return a.document == b.document
+        && a.pageNum == b.pageNum
+        && qFuzzyCompare(a.zoomFactor, b.zoomFactor);
+}
+
+static bool isSameRequest(const RenderRequest& a, const RenderRequest& b)
+{
+    return isSamePage(a, b) && a.tileRect == b.tileRect && a.textOnly == b.textOnly;
+}
+
+fz_locks_context* RenderService::lockContext()
+{
+    static QMutex mutexes[FZ_LOCK_MAX];
+    static fz_locks_context locks = { mutexes, lockMupdf, unlockMupdf };
+    return &locks;
+}
+
+RenderService::RenderService(fz_context* ctx, QObject* parent)
+    : QObject(parent),
+    m_ctx(ctx),
+    m_nextSequence(0),
+    m_activeWorkers(0)
+{
+    qRegisterMetaType<RenderResult>();
+    m_pool.setMaxThreadCount(std::max(2, QThread::idealThreadCount() - 1));
+}
+
+RenderService::~RenderService()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_queue.clear();
+        for (const auto& job : std::as_const(m_running)) {
+            job->cookie.abort = 1;
+        }
+    }
+    m_pool.waitForDone();
+}
+
+void RenderService::requestPage(const RenderRequest& request, Priority priority)
+{
+    if (!request.document) return;
+
+    QMutexLocker locker(&m_mutex);
+
+    if (priority == VisiblePriority) {
+        m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(), [&](const std::shared_ptr<Job>& job) {
+            return job->priority == VisiblePriority
+                && job->request.document == request.document
+                && !isSamePage(job->request, request);
+        }), m_queue.end());
+
+        for (const auto& job : std::as_const(m_running)) {
+            if (job->priority == VisiblePriority
+                && job->request.document == request.document
+                && !isSamePage(job->request, request)) {
+                job->cookie.abort = 1;
+            }
+        }
+    }
+
+    for (const auto& job : std::as_const(m_running)) {
+        if (!job->cookie.abort && isSameRequest(job->request, request)) return;
+    }
+    for (const auto& job : std::as_const(m_queue)) {
+        if (isSameRequest(job->request, request)) {
+            if (priority < job->priority) {
+                job->priority = priority;
+                std::stable_sort(m_queue.begin(), m_queue.end(), [](const std::shared_ptr<Job>& a, const std::shared_ptr<Job>& b) {
+                    return a->priority < b->priority;
+                });
+            }
+            return;
+        }
+    }
+
+    auto job = std::make_shared<Job>();
+    job->request = request;
+    job->priority = priority;
+    job->sequence = m_nextSequence++;
+    job->cookie = fz_cookie();
+    enqueue(job);
+}
+
+void RenderService::enqueue(const std::shared_ptr<Job>& job)
+{
+    auto pos = std::upper_bound(m_queue.begin(), m_queue.end(), job, [](const std::shared_ptr<Job>& a, const std::shared_ptr<Job>& b) {
+        if (a->priority != b->priority) return a->priority < b->priority;
+        return a->sequence < b->sequence;
+    });
+    m_queue.insert(pos, job);
+
+    if (m_activeWorkers < m_pool.maxThreadCount()) {
+        ++m_activeWorkers;
+        QtConcurrent::run(&m_pool, [this] { workerLoop(); });
+    }
+}
+
+void RenderService::cancelPrefetch(const Document* document)
+{
+    QMutexLocker locker(&m_mutex);
+    m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(), [&](const std::shared_ptr<Job>& job) {
+        return job->priority == PrefetchPriority && job->request.document == document;
+    }), m_queue.end());
+}
+
+void RenderService::cancelDocument(const Document* document)
+{
+    QMutexLocker locker(&m_mutex);
+    m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(), [&](const std::shared_ptr<Job>& job) {
+        return job->request.document == document;
+    }), m_queue.end());
+
+    auto isRunning = [&] {
+        bool running = false;
+        for (const auto& job : std::as_const(m_running)) {
+            if (job->request.document == document) {
+                job->cookie.abort = 1;
+                running = true;
+            }
+        }
+        return running;
+    };
+    while (isRunning()) {
+        m_jobFinished.wait(&m_mutex);
+    }
+}
+
+void RenderService::workerLoop()
+{
+    fz_context* ctx = fz_clone_context(m_ctx);
+    if (!ctx) {
+        qWarning() << "Failed to clone MuPDF context for render worker";
+    }
+
+    for (;;) {
+        std::shared_ptr<Job> job;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (!ctx || m_queue.isEmpty()) {
+                --m_activeWorkers;
+                break;
+            }
+            job = m_queue.takeFirst();
+            m_running.append(job);
+        }
+
+        // Prefetching must never compete with the page the user is waiting for.
+        QThread::currentThread()->setPriority(job->priority == PrefetchPriority ? QThread::IdlePriority : QThread::NormalPriority);
+        runJob(ctx, *job);
+
+        QMutexLocker locker(&m_mutex);
+        m_running.removeOne(job);
+        m_jobFinished.wakeAll();
+    }
+
+    if (ctx) fz_drop_context(ctx);
+}
+
+void RenderService::runJob(fz_context* ctx, Job& job)
+{
+    const RenderRequest& request = job.request;
+    QElapsedTimer timer;
+    timer.start();
+    if (request.textOnly) {
+        RenderResult result;
+        result.request = request;
+        result.textLayer = request.document->getTextLayer(ctx, request.pageNum);
+        result.renderMs = timer.elapsed();
+        if (!job.cookie.abort && result.textLayer) {
+            emit pageRendered(result);
+        }
+        return;
+    }
+
+    fz_display_list* list = request.document->loadDisplayList(ctx, request.pageNum);
+    if (!list) return;
+
+    RenderResult result;
+    result.request = request;
+    result.image = request.document->renderDisplayList(ctx, list, request.zoomFactor, request.tileRect, &job.cookie);
+    fz_drop_display_list(ctx, list);
+
+    if (!job.cookie.abort && !result.image.isNull() && request.tileRect.isNull()) {
+        result.textLayer = request.document->getTextLayer(ctx, request.pageNum);
+    }
+    result.renderMs = timer.elapsed();
+
+    if (!job.cookie.abort && !result.image.isNull()) {
+        emit pageRendered(result);
+    }
+}
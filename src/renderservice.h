@@ -0,0 +1,95 @@
+#pragma once
+
+#include <QObject>
+#include <QMetaType>
+#include <QString>
+#include <QImage>
+#include <QVector>
+#include <QRectF>
+#include <QRect>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <memory>
+#include <mupdf/fitz.h>
+
+#include "textlayer.h"
+
+class Document;
+
+// A text-only request extracts the page's text layer and renders nothing, which is
+// how a page shown from cached images or as tiles gets its selectable text.
+struct RenderRequest {
+    Document* document = nullptr;
+    quint32 documentId = 0;
+    int pageNum = -1;
+    qreal zoomFactor = 1.0;
+    QRect tileRect;
+    bool textOnly = false;
+};
+
+struct RenderResult {
+    RenderRequest request;
+    QImage image;
+    QSharedPointer<const TextLayer> textLayer;
+    qint64 renderMs = 0;
+};
+Q_DECLARE_METATYPE(RenderResult)
+
+// Runs MuPDF rasterisation on a small pool of worker threads so page turns never
+// block the GUI. Every worker renders with its own clone of the main fz_context;
+// results come back through pageRendered() on the GUI thread.
+class RenderService : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Priority { VisiblePriority, PrefetchPriority };
+
+    explicit RenderService(fz_context* ctx, QObject* parent = nullptr);
+    ~RenderService();
+    RenderService(const RenderService&) = delete;
+    RenderService& operator=(const RenderService&) = delete;
+
+    // Lock callbacks the main context must be created with before it can be cloned.
+    static fz_locks_context* lockContext();
+
+    // Queues a render. A visible request supersedes every visible request for another
+    // page or zoom of the same document: queued ones are dropped, running ones are
+    // aborted. Tiles of the same page never cancel each other.
+    void requestPage(const RenderRequest& request, Priority priority = VisiblePriority);
+
+    // Drops queued prefetch work for the document, e.g. after the reader changed
+    // direction. Prefetch jobs already running are left to finish into the cache.
+    void cancelPrefetch(const Document* document);
+
+    // Drops all queued work for the document and blocks until running jobs on it
+    // have been aborted, so the Document can be deleted safely afterwards.
+    void cancelDocument(const Document* document);
+
+signals:
+    void pageRendered(const RenderResult& result);
+
+private:
+    struct Job {
+        RenderRequest request;
+        Priority priority;
+        quint64 sequence;
+        fz_cookie cookie;
+    };
+
+    void enqueue(const std::shared_ptr<Job>& job);
+    void workerLoop();
+    void runJob(fz_context* ctx, Job& job);
+
+    fz_context* m_ctx;
+    QThreadPool m_pool;
+    QMutex m_mutex;
+    QWaitCondition m_jobFinished;
+    QList<std::shared_ptr<Job>> m_queue;
+    QList<std::shared_ptr<Job>> m_running;
+    quint64 m_nextSequence;
+    int m_activeWorkers;
+};
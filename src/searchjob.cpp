@@ -0,0 +1,291 @@
+#include "searchjob.h"
+
+#include <QtConcurrent>
+#include <QThread>
+#include <QMutex>
+#include <QDebug>
+#include <atomic>
+#include <algorithm>
+
+static const int ContextChars = 20;
+
+// Everything the workers touch. The job holds one reference and every worker
+// another, so a job deleted mid-search leaves its workers with valid state to
+// wind down on.
+struct SearchJob::Shared
+{
+    fz_context* ctx;
+    QString filepath;
+    int pageCount;
+    QSharedPointer<const CompiledQuery> query;
+    QVector<int> pages;
+    std::atomic<int> nextSlot{ 0 };
+    std::atomic<bool> cancelled{ false };
+    std::atomic<bool> extractionFailed{ false };
+    QByteArray fingerprint;
+    TextIndex index;
+    bool useIndex = false;
+    QVector<PageText> extracted;
+    PageText* extractedPages = nullptr;
+
+    QMutex mutex;
+    SearchJob* job = nullptr;       // cleared when the job is deleted
+    QList<fz_cookie*> cookies;      // of the workers extracting a page
+};
+
+// Extraction through the device rather than fz_new_stext_page_from_page(), which
+// takes no cookie, so a cancelled search abandons the page it is on.
+static fz_stext_page* extractText(fz_context* ctx, fz_page* page, fz_cookie* cookie)
+{
+    fz_stext_page* stext_page = fz_new_stext_page(ctx, fz_bound_page(ctx, page));
+    fz_device* device = nullptr;
+    fz_try(ctx) {
+        device = fz_new_stext_device(ctx, stext_page, nullptr);
+        fz_run_page(ctx, page, device, fz_identity, cookie);
+        fz_close_device(ctx, device);
+    } fz_always(ctx) {
+        fz_drop_device(ctx, device);
+    } fz_catch(ctx) {
+        fz_drop_stext_page(ctx, stext_page);
+        fz_rethrow(ctx);
+    }
+    return stext_page;
+}
+
+SearchJob::SearchJob(fz_context* ctx, const QString& filepath, int pageCount, const QSharedPointer<const CompiledQuery>& query, QObject* parent)
+    : QObject(parent),
+    m_shared(QSharedPointer<Shared>::create()),
+    m_nextToDeliver(0)
+{
+    m_shared->ctx = ctx;
+    m_shared->filepath = filepath;
+    m_shared->pageCount = pageCount;
+    m_shared->query = query;
+    m_shared->job = this;
+
+    m_pages.reserve(pageCount);
+    for (int i = 0; i < pageCount; ++i) {
+        m_pages.append(i);
+    }
+}
+
+SearchJob::~SearchJob()
+{
+    cancel();
+    // Results already queued to this job are dropped along with it.
+    QMutexLocker locker(&m_shared->mutex);
+    m_shared->job = nullptr;
+}
+
+QThreadPool* SearchJob::threadPool()
+{
+    static QThreadPool pool;
+    return &pool;
+}
+
+void SearchJob::restrictToPages(const QVector<int>& pages)
+{
+    m_pages.clear();
+    for (int pageNum : pages) {
+        if (pageNum >= 0 && pageNum < m_shared->pageCount) m_pages.append(pageNum);
+    }
+}
+
+QString SearchJob::filepath() const
+{
+    return m_shared->filepath;
+}
+
+QVector<int> SearchJob::refinementPages() const
+{
+    QVector<int> pages;
+    for (int pageNum : m_pages) {
+        if (!m_searchedPages.contains(pageNum) || m_hitPages.contains(pageNum)) {
+            pages.append(pageNum);
+        }
+    }
+    return pages;
+}
+
+void SearchJob::start()
+{
+    Shared& shared = *m_shared;
+    if (m_pages.isEmpty() || !shared.query->isValid()) {
+        QMetaObject::invokeMethod(this, &SearchJob::finished, Qt::QueuedConnection);
+        return;
+    }
+
+    shared.pages = m_pages;
+    shared.fingerprint = TextIndex::fingerprint(shared.filepath);
+    shared.useIndex = !shared.fingerprint.isEmpty()
+        && shared.index.open(TextIndex::indexPathFor(shared.fingerprint), shared.fingerprint)
+        && shared.index.pageCount() == shared.pageCount;
+    if (!shared.useIndex && m_pages.size() == shared.pageCount) {
+        shared.extracted.resize(shared.pageCount);
+        shared.extractedPages = shared.extracted.data();
+    }
+
+    const int workerCount = std::clamp(QThread::idealThreadCount(), 1, int(m_pages.size()));
+    for (int i = 0; i < workerCount; ++i) {
+        QtConcurrent::run(threadPool(), [shared = m_shared] { workerLoop(shared); });
+    }
+}
+
+void SearchJob::cancel()
+{
+    m_shared->cancelled = true;
+    QMutexLocker locker(&m_shared->mutex);
+    for (fz_cookie* cookie : std::as_const(m_shared->cookies)) {
+        cookie->abort = 1;
+    }
+}
+
+void SearchJob::deliver(Shared& shared, int slot, const QVector<SearchResult>& results)
+{
+    QMutexLocker locker(&shared.mutex);
+    if (SearchJob* job = shared.job) {
+        QMetaObject::invokeMethod(job, [job, slot, results] { job->pageDone(slot, results); }, Qt::QueuedConnection);
+    }
+}
+
+void SearchJob::workerLoop(const QSharedPointer<Shared>& sharedPointer)
+{
+    Shared& shared = *sharedPointer;
+    int slot;
+    if (shared.useIndex) {
+        while (!shared.cancelled && (slot = shared.nextSlot++) < shared.pages.size()) {
+            const int pageNum = shared.pages[slot];
+            deliver(shared, slot, searchPage(shared.index.page(pageNum), pageNum, *shared.query));
+        }
+        return;
+    }
+
+    fz_context* ctx = fz_clone_context(shared.ctx);
+    fz_document* doc = nullptr;
+    if (ctx) {
+        fz_try(ctx) {
+            doc = fz_open_document(ctx, shared.filepath.toStdString().c_str());
+        } fz_catch(ctx) {
+            qWarning() << "Search worker failed to open document:" << fz_caught_message(ctx);
+        }
+    } else {
+        qWarning() << "Failed to clone MuPDF context for search worker";
+    }
+
+    fz_cookie cookie = fz_cookie();
+    {
+        QMutexLocker locker(&shared.mutex);
+        shared.cookies.append(&cookie);
+        if (shared.cancelled) cookie.abort = 1;
+    }
+
+    // Pages are still claimed and reported after a failure so the job completes,
+    // but the incomplete text is not written to the index.
+    if (!doc) shared.extractionFailed = true;
+    while (!shared.cancelled && (slot = shared.nextSlot++) < shared.pages.size()) {
+        const int pageNum = shared.pages[slot];
+        QVector<SearchResult> results;
+        if (doc) {
+            fz_page* page = nullptr;
+            fz_stext_page* stext_page = nullptr;
+            fz_try(ctx) {
+                page = fz_load_page(ctx, doc, pageNum);
+                stext_page = extractText(ctx, page, &cookie);
+            } fz_catch(ctx) {
+                qWarning() << "Search failed on page" << pageNum << ":" << fz_caught_message(ctx);
+                shared.extractionFailed = true;
+            }
+            // An aborted page holds only part of its text; the job is gone or
+            // ignoring results by then, so it is simply dropped.
+            if (stext_page && !cookie.abort) {
+                PageText pageText = PageText::fromTextLayer(*TextLayer::fromStextPage(stext_page));
+                results = searchPage(pageText.view(), pageNum, *shared.query);
+                if (shared.extractedPages) {
+                    // Each page is claimed by exactly one worker, so its slot is too.
+                    shared.extractedPages[pageNum] = std::move(pageText);
+                }
+            }
+            if (stext_page) fz_drop_stext_page(ctx, stext_page);
+            if (page) fz_drop_page(ctx, page);
+        }
+        if (cookie.abort) break;
+        deliver(shared, slot, results);
+    }
+
+    {
+        QMutexLocker locker(&shared.mutex);
+        shared.cookies.removeOne(&cookie);
+    }
+    if (doc) fz_drop_document(ctx, doc);
+    if (ctx) fz_drop_context(ctx);
+}
+
+void SearchJob::pageDone(int slot, const QVector<SearchResult>& results)
+{
+    if (m_shared->cancelled) return;
+
+    m_searchedPages.insert(m_pages[slot]);
+    if (!results.isEmpty()) m_hitPages.insert(m_pages[slot]);
+    m_pending.insert(slot, results);
+    QVector<SearchResult> ready;
+    while (!m_pending.isEmpty() && m_pending.firstKey() == m_nextToDeliver) {
+        ready += m_pending.take(m_nextToDeliver);
+        ++m_nextToDeliver;
+    }
+
+    if (!ready.isEmpty()) {
+        emit resultsFound(ready);
+    }
+    if (m_nextToDeliver == m_pages.size()) {
+        writeIndex();
+        emit finished();
+    }
+}
+
+void SearchJob::writeIndex()
+{
+    Shared& shared = *m_shared;
+    if (!shared.extractedPages || shared.extractionFailed || shared.fingerprint.isEmpty()) return;
+
+    // Every page has been delivered, so no worker writes to the extracted text any
+    // more. Written on the search pool, which is waited for at shutdown, so the
+    // file is never left half-committed.
+    const QString indexPath = TextIndex::indexPathFor(shared.fingerprint);
+    QtConcurrent::run(threadPool(), [indexPath, fingerprint = shared.fingerprint, pages = std::move(shared.extracted)] {
+        TextIndex::write(indexPath, fingerprint, pages);
+    });
+    shared.extractedPages = nullptr;
+}
+
+QVector<SearchResult> SearchJob::searchPage(const PageTextView& page, int pageNum, const CompiledQuery& query)
+{
+    QVector<SearchResult> results;
+    const qsizetype rawSize = page.raw.size();
+    for (const CompiledQuery::Hit& hit : query.match(page)) {
+        const qsizetype rawStart = hit.range.first;
+        const qsizetype rawEnd = hit.range.second;
+        if (rawStart < 0 || rawStart >= rawEnd || rawEnd > rawSize) continue;
+
+        QRectF combinedRect;
+        for (qsizetype j = rawStart; j < rawEnd; ++j) {
+            if (!page.boxes[j].isEmpty()) {
+                const QRectF box = page.boxes[j].toRect();
+                combinedRect = combinedRect.isNull() ? box : combinedRect.united(box);
+            }
+        }
+
+        if (!combinedRect.isNull()) {
+            SearchResult result;
+            result.pageNum = pageNum;
+            result.location = combinedRect;
+            result.textStart = int(rawStart);
+            result.textEnd = int(rawEnd);
+            result.distance = hit.distance;
+            const qsizetype contextStart = std::max<qsizetype>(0, rawStart - ContextChars);
+            const qsizetype contextEnd = std::min<qsizetype>(rawSize, rawEnd + ContextChars);
+            result.context = page.raw.mid(contextStart, contextEnd - contextStart).toString().simplified();
+            results.append(result);
+        }
+    }
+    return results;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QMap>
+#include <QSet>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <mupdf/fitz.h>
+
+#include "document.h"
+#include "textindex.h"
+#include "searchquery.h"
+
+// Searches every page of a document on the global thread pool. A document with a
+// text index on disk is searched straight from the mapped index. Otherwise each
+// worker opens its own handle on the file with a cloned context, so searching
+// never waits on the renderers or the GUI, and a search that runs to completion
+// writes the index for next time. Hits are delivered in page order as soon as
+// every earlier page is done. cancel() and the destructor return at once: the
+// workers share their state with the job rather than pointing into it, abort the
+// page they are extracting and deliver nothing more.
+class SearchJob : public QObject
+{
+    Q_OBJECT
+
+public:
+    SearchJob(fz_context* ctx, const QString& filepath, int pageCount, const QSharedPointer<const CompiledQuery>& query, QObject* parent = nullptr);
+    ~SearchJob();
+    SearchJob(const SearchJob&) = delete;
+    SearchJob& operator=(const SearchJob&) = delete;
+
+    // Limits the search to the given pages, in that order. Must be called before start().
+    void restrictToPages(const QVector<int>& pages);
+    void start();
+    void cancel();
+
+    QString filepath() const;
+
+    // A query that refines this job's query (CompiledQuery::isRefinementOf) can
+    // only match on pages where this one matched, or on pages it has not searched
+    // yet; refinementPages() lists those, so typing more letters narrows the
+    // previous search instead of starting over.
+    QVector<int> refinementPages() const;
+
+    static QVector<SearchResult> searchPage(const PageTextView& page, int pageNum, const CompiledQuery& query);
+
+    // Search workers may outlive the job that started them, and they borrow the base
+    // context through their clones, so whoever drops it waits for this pool first.
+    static QThreadPool* threadPool();
+
+signals:
+    void resultsFound(const QVector<SearchResult>& results);
+    void finished();
+
+private:
+    struct Shared;
+
+    static void workerLoop(const QSharedPointer<Shared>& shared);
+    static void deliver(Shared& shared, int slot, const QVector<SearchResult>& results);
+    void pageDone(int slot, const QVector<SearchResult>& results);
+    void writeIndex();
+
+    QSharedPointer<Shared> m_shared;
+    QVector<int> m_pages;
+    QMap<int, QVector<SearchResult>> m_pending;
+    int m_nextToDeliver;
+    QSet<int> m_searchedPages;
+    QSet<int> m_hitPages;
+};
@@ -0,0 +1,324 @@
+#include "searchquery.h"
+#include "textnormalizer.h"
+
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cstdlib>
+
+static const int CompiledQueryCacheSize = 32;
+static const int DefaultNearWords = 10;
+
+static bool isWordUnit(QChar c)
+{
+    return c.isLetterOrNumber() || c == QLatin1Char('_') || c.isSurrogate();
+}
+
+static QString normalizedTerm(const QString& text)
+{
+    return PageText::normalize(text.simplified());
+}
+
+static QString exactTerm(const QString& text)
+{
+    return TextNormalizer::normalize(text.simplified(), TextNormalizer::CaseFold).text.normalized(QString::NormalizationForm_C);
+}
+
+// The index only holds folded text, so a hit found there is checked against the
+// raw text under it. Marks of a decomposed accent on the last letter fold away
+// and map to no normalised unit, so the raw range is extended over them.
+static bool hasExactDiacritics(const PageTextView& page, qsizetype start, qsizetype end, const QString& exact)
+{
+    const qsizetype rawStart = page.normalizedToRaw[start];
+    qsizetype rawEnd = qsizetype(page.normalizedToRaw[end - 1]) + 1;
+    while (rawEnd < page.raw.size() && page.raw[rawEnd].isMark()) ++rawEnd;
+    const QStringView raw = page.raw.mid(rawStart, rawEnd - rawStart);
+    return TextNormalizer::normalize(raw, TextNormalizer::CaseFold).text.normalized(QString::NormalizationForm_C) == exact;
+}
+
+// Longest run of letters and digits the pattern can only match literally.
+// Anything inside a group, class or repeat count, or made optional by a
+// quantifier, is skipped, and an alternation anywhere disables the prefilter.
+// So do inline options and start-of-pattern verbs, since (?x) turns spaces and
+// '#' into syntax and (?-i) makes literals case-sensitive.
+static QString requiredLiteral(const QRegularExpression& regex)
+{
+    static const QRegularExpression inlineOptions(QStringLiteral("\\(\\?(\\^[imnsxJU-]*|[imnsxJU-]+)[:)]|\\(\\*"));
+    const QString pattern = regex.pattern();
+    if (regex.patternOptions() & QRegularExpression::ExtendedPatternSyntaxOption) return QString();
+    if (pattern.contains(QLatin1Char('|')) || pattern.contains(inlineOptions)) return QString();
+
+    QString best;
+    QString run;
+    int depth = 0;
+    auto endRun = [&] {
+        if (run.size() > best.size()) best = run;
+        run.clear();
+    };
+    for (qsizetype i = 0; i < pattern.size(); ++i) {
+        const QChar c = pattern[i];
+        if (c == QLatin1Char('\\')) {
+            endRun();
+            ++i;
+        } else if (c == QLatin1Char('(') || c == QLatin1Char('[') || c == QLatin1Char('{')) {
+            endRun();
+            ++depth;
+        } else if (c == QLatin1Char(')') || c == QLatin1Char(']') || c == QLatin1Char('}')) {
+            depth = std::max(0, depth - 1);
+        } else if (depth == 0 && c.isLetterOrNumber()) {
+            const QChar next = i + 1 < pattern.size() ? pattern[i + 1] : QChar();
+            if (next == QLatin1Char('?') || next == QLatin1Char('*') || next == QLatin1Char('{')) {
+                endRun();
+            } else {
+                run.append(c);
+            }
+        } else {
+            endRun();
+        }
+    }
+    endRun();
+    return best.size() >= 3 ? normalizedTerm(best) : QString();
+}
+
+QSharedPointer<const CompiledQuery> CompiledQuery::compile(const SearchQuery& query)
+{
+    static QMutex cacheMutex;
+    static QCache<QString, QSharedPointer<const CompiledQuery>> cache(CompiledQueryCacheSize);
+
+    const QString key = QString::number(query.mode) + QLatin1Char(':') + QString::number(query.maxDistance)
+        + QLatin1Char(':') + QString::number(query.matchDiacritics) + QLatin1Char(':') + query.text;
+    QMutexLocker locker(&cacheMutex);
+    if (QSharedPointer<const CompiledQuery>* cached = cache.object(key)) {
+        return *cached;
+    }
+
+    QSharedPointer<CompiledQuery> compiled(new CompiledQuery);
+    compiled->m_query = query;
+    switch (query.mode) {
+    case Literal:
+    case WholeWord: {
+        Clause clause;
+        clause.terms.append({ normalizedTerm(query.text), query.mode == WholeWord, exactTerm(query.text) });
+        if (!clause.terms.first().normalized.isEmpty()) {
+            compiled->m_clauses.append(clause);
+        }
+        break;
+    }
+    case Regex:
+        compiled->m_regex = QRegularExpression(query.text, QRegularExpression::CaseInsensitiveOption
+                                                           | QRegularExpression::UseUnicodePropertiesOption);
+        if (!compiled->m_regex.isValid()) {
+            compiled->m_error = compiled->m_regex.errorString();
+        } else {
+            compiled->m_regex.optimize();
+            compiled->m_requiredLiteral = requiredLiteral(compiled->m_regex);
+        }
+        break;
+    case Boolean:
+        compiled->parseBoolean(query.text);
+        break;
+    case Fuzzy:
+        compiled->m_fuzzy = FuzzyMatcher(normalizedTerm(query.text), query.maxDistance);
+        if (compiled->m_fuzzy.isEmpty()) {
+            compiled->m_error = QStringLiteral("Nothing to search for");
+        }
+        break;
+    }
+    if (query.mode != Regex && query.mode != Fuzzy && compiled->m_clauses.isEmpty()) {
+        compiled->m_error = QStringLiteral("Nothing to search for");
+    }
+
+    cache.insert(key, new QSharedPointer<const CompiledQuery>(compiled));
+    return compiled;
+}
+
+const SearchQuery& CompiledQuery::query() const { return m_query; }
+bool CompiledQuery::isValid() const { return m_error.isEmpty(); }
+QString CompiledQuery::errorString() const { return m_error; }
+
+bool CompiledQuery::isRefinementOf(const CompiledQuery& previous) const
+{
+    if (m_query.mode != Literal || previous.m_query.mode != Literal) return false;
+    if (m_clauses.isEmpty() || previous.m_clauses.isEmpty()) return false;
+    const Term& term = m_clauses.first().terms.first();
+    const Term& previousTerm = previous.m_clauses.first().terms.first();
+    if (previous.m_query.matchDiacritics) {
+        return m_query.matchDiacritics && term.exact.contains(previousTerm.exact);
+    }
+    return term.normalized.contains(previousTerm.normalized);
+}
+
+void CompiledQuery::parseBoolean(const QString& text)
+{
+    // Split into words and "quoted phrases"; AND binds tighter than OR, and
+    // adjacent terms without an operator are ANDed.
+    QStringList tokens;
+    QString current;
+    bool inQuotes = false;
+    for (QChar c : text) {
+        if (c == QLatin1Char('"')) {
+            if (inQuotes) {
+                tokens.append(QString(QLatin1Char('"')) + current);
+                current.clear();
+            } else if (!current.isEmpty()) {
+                tokens.append(current);
+                current.clear();
+            }
+            inQuotes = !inQuotes;
+        } else if (c.isSpace() && !inQuotes) {
+            if (!current.isEmpty()) tokens.append(current);
+            current.clear();
+        } else {
+            current.append(c);
+        }
+    }
+    if (!current.isEmpty()) tokens.append(inQuotes ? QString(QLatin1Char('"')) + current : current);
+
+    Clause clause;
+    int pendingNear = -1;
+    auto closeClause = [&] {
+        if (!clause.terms.isEmpty()) m_clauses.append(clause);
+        clause = Clause();
+        pendingNear = -1;
+    };
+    for (const QString& token : std::as_const(tokens)) {
+        if (token == QLatin1String("OR")) {
+            closeClause();
+        } else if (token == QLatin1String("AND")) {
+            pendingNear = -1;
+        } else if (token == QLatin1String("NEAR") || token.startsWith(QLatin1String("NEAR/"))) {
+            bool ok = false;
+            const int words = token.mid(5).toInt(&ok);
+            pendingNear = ok && words > 0 ? words : DefaultNearWords;
+        } else {
+            const QString word = token.startsWith(QLatin1Char('"')) ? token.mid(1) : token;
+            const QString term = normalizedTerm(word);
+            if (term.isEmpty()) continue;
+            if (!clause.terms.isEmpty()) clause.nearWords.append(pendingNear);
+            clause.terms.append({ term, false, exactTerm(word) });
+            pendingNear = -1;
+        }
+    }
+    closeClause();
+}
+
+QVector<CompiledQuery::Hit> CompiledQuery::match(const PageTextView& page) const
+{
+    if (!isValid()) return QVector<Hit>();
+    if (m_query.mode == Fuzzy) return matchFuzzy(page);
+
+    QVector<Range> ranges;
+    if (m_query.mode == Regex) {
+        ranges = matchRegex(page);
+    } else {
+        for (const Clause& clause : m_clauses) {
+            ranges += matchClause(clause, page);
+        }
+        if (m_clauses.size() > 1) {
+            std::sort(ranges.begin(), ranges.end());
+            ranges.erase(std::unique(ranges.begin(), ranges.end()), ranges.end());
+        }
+    }
+
+    QVector<Hit> hits;
+    hits.reserve(ranges.size());
+    for (const Range& range : std::as_const(ranges)) {
+        hits.append({ range, 0 });
+    }
+    return hits;
+}
+
+QVector<CompiledQuery::Range> CompiledQuery::matchClause(const Clause& clause, const PageTextView& page) const
+{
+    const QStringView text = page.normalized;
+
+    // Early rejection: every term has to occur somewhere on the page.
+    for (const Term& term : clause.terms) {
+        if (TextNormalizer::find(text, term.normalized) < 0) return QVector<Range>();
+    }
+
+    // Occurrences per term, in normalised units.
+    QVector<QVector<Range>> occurrences(clause.terms.size());
+    for (int t = 0; t < clause.terms.size(); ++t) {
+        const Term& term = clause.terms[t];
+        for (qsizetype from = 0; (from = TextNormalizer::find(text, term.normalized, from)) >= 0; ) {
+            const qsizetype end = from + term.normalized.size();
+            const bool bounded = !term.wholeWord
+                || ((from == 0 || !isWordUnit(text[from - 1])) && (end == text.size() || !isWordUnit(text[end])));
+            const bool accepted = bounded && (!m_query.matchDiacritics || hasExactDiacritics(page, from, end, term.exact));
+            if (accepted) occurrences[t].append({ from, end });
+            from = accepted ? end : from + 1;
+        }
+        if (occurrences[t].isEmpty()) return QVector<Range>();
+    }
+
+    // NEAR: keep only occurrences with a partner close enough, measured in words.
+    if (std::any_of(clause.nearWords.cbegin(), clause.nearWords.cend(), [](int words) { return words >= 0; })) {
+        QVector<int> wordAt(text.size() + 1);
+        int words = 0;
+        for (qsizetype i = 0; i < text.size(); ++i) {
+            wordAt[i] = words;
+            if (text[i].isSpace()) ++words;
+        }
+        wordAt[text.size()] = words;
+
+        auto keepNear = [&](QVector<Range>& own, const QVector<Range>& other, int maxWords) {
+            own.erase(std::remove_if(own.begin(), own.end(), [&](const Range& a) {
+                return std::none_of(other.cbegin(), other.cend(), [&](const Range& b) {
+                    return std::abs(wordAt[a.first] - wordAt[b.first]) <= maxWords;
+                });
+            }), own.end());
+        };
+        for (int i = 0; i < clause.nearWords.size(); ++i) {
+            const int maxWords = clause.nearWords[i];
+            if (maxWords < 0) continue;
+            const QVector<Range> left = occurrences[i];
+            keepNear(occurrences[i], occurrences[i + 1], maxWords);
+            keepNear(occurrences[i + 1], left, maxWords);
+            if (occurrences[i].isEmpty() || occurrences[i + 1].isEmpty()) return QVector<Range>();
+        }
+    }
+
+    QVector<Range> hits;
+    for (const QVector<Range>& termHits : std::as_const(occurrences)) {
+        for (const Range& hit : termHits) {
+            hits.append({ qsizetype(page.normalizedToRaw[hit.first]), qsizetype(page.normalizedToRaw[hit.second - 1]) + 1 });
+        }
+    }
+    if (clause.terms.size() > 1) {
+        std::sort(hits.begin(), hits.end());
+    }
+    return hits;
+}
+
+QVector<CompiledQuery::Range> CompiledQuery::matchRegex(const PageTextView& page) const
+{
+    QVector<Range> hits;
+    if (!m_requiredLiteral.isEmpty() && TextNormalizer::find(page.normalized, m_requiredLiteral) < 0) {
+        return hits;
+    }
+
+    // Wraps the (possibly memory-mapped) page text without copying it.
+    const QString raw = QString::fromRawData(page.raw.data(), page.raw.size());
+    QRegularExpressionMatchIterator it = m_regex.globalMatch(raw);
+    while (it.hasNext()) {
+        const QRegularExpressionMatch match = it.next();
+        if (match.capturedLength() > 0) {
+            hits.append({ match.capturedStart(), match.capturedEnd() });
+        }
+    }
+    return hits;
+}
+
+QVector<CompiledQuery::Hit> CompiledQuery::matchFuzzy(const PageTextView& page) const
+{
+    QVector<Hit> hits;
+    if (!m_fuzzy.mayMatch(page.normalized)) return hits;
+
+    for (const FuzzyMatcher::Match& match : m_fuzzy.find(page.normalized)) {
+        if (match.start >= match.end) continue;
+        hits.append({ Range(page.normalizedToRaw[match.start], qsizetype(page.normalizedToRaw[match.end - 1]) + 1), match.distance });
+    }
+    return hits;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+#include <QPair>
+#include <QSharedPointer>
+#include <QRegularExpression>
+
+#include "textindex.h"
+#include "fuzzymatcher.h"
+
+struct SearchQuery
+{
+    enum Mode {
+        Literal,    // case-insensitive substring, diacritic-insensitive unless matchDiacritics
+        WholeWord,  // the same, bounded by non-word characters on both sides
+        Regex,      // QRegularExpression over the page text, case-insensitive
+        Boolean,    // terms or "quoted phrases" joined by AND, OR and NEAR/n (words)
+        Fuzzy       // literal with up to maxDistance typos, for noisy OCR text layers
+    };
+
+    QString text;
+    Mode mode = Literal;
+    int maxDistance = 0;
+    // Literal, WholeWord and Boolean terms only: Regex already runs on the raw
+    // text, and Fuzzy treats a missing accent as just another typo.
+    bool matchDiacritics = false;
+};
+
+// A query prepared for matching. It is immutable, so one instance is shared by
+// every search worker, and compile() keeps the most recent ones, which repeated
+// and incrementally typed queries hit.
+class CompiledQuery
+{
+public:
+    typedef QPair<qsizetype, qsizetype> Range;   // [start, end) in raw text units
+
+    struct Hit {
+        Range range;
+        int distance;   // edits needed to match, only ever non-zero in Fuzzy mode
+    };
+
+    static QSharedPointer<const CompiledQuery> compile(const SearchQuery& query);
+
+    const SearchQuery& query() const;
+    bool isValid() const;
+    QString errorString() const;
+
+    // True when every hit of this query lies inside a hit of the previous one, as
+    // with a literal query that contains the previous literal query.
+    bool isRefinementOf(const CompiledQuery& previous) const;
+
+    // Every hit on the page in page order. Pages that cannot match are rejected on
+    // the cheapest check available (a missing required term or literal) before
+    // any hit is collected.
+    QVector<Hit> match(const PageTextView& page) const;
+
+private:
+    struct Term {
+        QString normalized;
+        bool wholeWord = false;
+        QString exact;      // case-folded only, what the raw text must match with matchDiacritics
+    };
+    // Terms that must all be present; nearWords[i] >= 0 additionally requires
+    // terms i and i + 1 to be at most that many words apart.
+    struct Clause {
+        QVector<Term> terms;
+        QVector<int> nearWords;
+    };
+
+    CompiledQuery() = default;
+    void parseBoolean(const QString& text);
+    QVector<Range> matchClause(const Clause& clause, const PageTextView& page) const;
+    QVector<Range> matchRegex(const PageTextView& page) const;
+    QVector<Hit> matchFuzzy(const PageTextView& page) const;
+
+    SearchQuery m_query;
+    QString m_error;
+    QVector<Clause> m_clauses;    // alternatives (OR)
+    QRegularExpression m_regex;
+    QString m_requiredLiteral;    // normalised literal every regex hit must contain
+    FuzzyMatcher m_fuzzy;
+};
@@ -0,0 +1,230 @@
+#include "searchresultsmodel.h"
+
+#include <QFileInfo>
+#include <QFont>
+#include <algorithm>
+#include <numeric>
+
+SearchResultsModel::SearchResultsModel(QObject* parent)
+    : QAbstractListModel(parent),
+    m_fileHeaders(false),
+    m_rowCount(0)
+{
+}
+
+void SearchResultsModel::setFileHeaders(bool fileHeaders)
+{
+    if (m_fileHeaders == fileHeaders) return;
+    clear();
+    m_fileHeaders = fileHeaders;
+}
+
+void SearchResultsModel::clear()
+{
+    beginResetModel();
+    m_groups.clear();
+    m_groupIndex.clear();
+    m_rowCount = 0;
+    m_message.clear();
+    endResetModel();
+}
+
+static bool ranksBefore(const SearchResult& a, const SearchResult& b)
+{
+    if (a.distance != b.distance) return a.distance < b.distance;
+    if (a.pageNum != b.pageNum) return a.pageNum < b.pageNum;
+    return a.textStart < b.textStart;
+}
+
+void SearchResultsModel::appendResults(const QString& filepath, const QVector<SearchResult>& results)
+{
+    if (results.isEmpty()) return;
+
+    if (!m_message.isEmpty()) {
+        beginResetModel();
+        m_message.clear();
+        endResetModel();
+    }
+
+    int g = m_groupIndex.value(filepath, -1);
+    if (g < 0) {
+        Group group;
+        group.filepath = filepath;
+        group.firstRow = m_rowCount;
+        g = m_groups.size();
+        if (m_fileHeaders) beginInsertRows(QModelIndex(), m_rowCount, m_rowCount);
+        m_groups.append(group);
+        m_groupIndex.insert(filepath, g);
+        if (m_fileHeaders) {
+            ++m_rowCount;
+            endInsertRows();
+        }
+    }
+
+    QVector<SearchResult> ranked = results;
+    std::stable_sort(ranked.begin(), ranked.end(), ranksBefore);
+
+    Group& group = m_groups[g];
+    const int first = group.results.size();
+    for (int i = 0; i < ranked.size(); ++i) {
+        group.resultsByPage[ranked[i].pageNum].append(first + i);
+    }
+    group.results += ranked;
+
+    // Exact searches deliver hits in rank order already, so they are appended in
+    // one go; only fuzzy hits that outrank earlier ones are inserted one by one.
+    if (group.order.isEmpty() || !ranksBefore(ranked.first(), group.results[group.order.last()])) {
+        insertRows(g, group.order.size(), ranked.size());
+    } else {
+        for (int i = first; i < group.results.size(); ++i) {
+            const auto pos = std::upper_bound(group.order.cbegin(), group.order.cend(), i, [&group](int a, int b) {
+                return ranksBefore(group.results[a], group.results[b]);
+            });
+            insertRows(g, int(pos - group.order.cbegin()), 1);
+        }
+    }
+
+    // The header shows the number of hits in its file.
+    if (m_fileHeaders) {
+        const QModelIndex headerIndex = index(group.firstRow);
+        emit dataChanged(headerIndex, headerIndex, { Qt::DisplayRole });
+    }
+}
+
+// Shows results appended to the group (and not in its order yet) at offset.
+void SearchResultsModel::insertRows(int g, int offset, int count)
+{
+    Group& group = m_groups[g];
+    const int row = group.firstRow + (m_fileHeaders ? 1 : 0) + offset;
+    beginInsertRows(QModelIndex(), row, row + count - 1);
+    QVector<int> added(count);
+    std::iota(added.begin(), added.end(), int(group.order.size()));
+    group.order.insert(offset, count, 0);
+    std::copy(added.cbegin(), added.cend(), group.order.begin() + offset);
+    for (int later = g + 1; later < m_groups.size(); ++later) {
+        m_groups[later].firstRow += count;
+    }
+    m_rowCount += count;
+    endInsertRows();
+}
+
+void SearchResultsModel::setMessage(const QString& message)
+{
+    if (!m_groups.isEmpty()) return;
+
+    beginResetModel();
+    m_message = message;
+    endResetModel();
+}
+
+bool SearchResultsModel::hasResults() const
+{
+    return !m_groups.isEmpty();
+}
+
+int SearchResultsModel::groupAt(int row) const
+{
+    auto it = std::upper_bound(m_groups.cbegin(), m_groups.cend(), row, [](int r, const Group& group) {
+        return r < group.firstRow;
+    });
+    return int(it - m_groups.cbegin()) - 1;
+}
+
+int SearchResultsModel::resultIndex(const Group& group, int row) const
+{
+    return row - group.firstRow - (m_fileHeaders ? 1 : 0);
+}
+
+bool SearchResultsModel::isResult(const QModelIndex& index) const
+{
+    if (!index.isValid() || index.row() >= m_rowCount || m_groups.isEmpty()) return false;
+    return resultIndex(m_groups[groupAt(index.row())], index.row()) >= 0;
+}
+
+const SearchResult& SearchResultsModel::result(int row) const
+{
+    const Group& group = m_groups[groupAt(row)];
+    return group.results.at(group.order.at(resultIndex(group, row)));
+}
+
+QString SearchResultsModel::filepath(int row) const
+{
+    if (row < 0 || row >= m_rowCount || m_groups.isEmpty()) return QString();
+    return m_groups[groupAt(row)].filepath;
+}
+
+int SearchResultsModel::nextResultRow(int row, int step) const
+{
+    if (m_groups.isEmpty()) return -1;
+
+    for (int i = 0; i < m_rowCount; ++i) {
+        row += step;
+        if (row >= m_rowCount) row = 0;
+        if (row < 0) row = m_rowCount - 1;
+        if (isResult(index(row))) return row;
+    }
+    return -1;
+}
+
+QVector<QRectF> SearchResultsModel::locationsOnPage(const QString& filepath, int pageNum) const
+{
+    QVector<QRectF> locations;
+    const int g = m_groupIndex.value(filepath, -1);
+    if (g < 0) return locations;
+
+    const Group& group = m_groups[g];
+    const auto it = group.resultsByPage.constFind(pageNum);
+    if (it == group.resultsByPage.cend()) return locations;
+
+    locations.reserve(it->size());
+    for (int i : *it) {
+        locations.append(group.results[i].location);
+    }
+    return locations;
+}
+
+int SearchResultsModel::rowCount(const QModelIndex& parent) const
+{
+    if (parent.isValid()) return 0;
+    if (m_groups.isEmpty()) return m_message.isEmpty() ? 0 : 1;
+    return m_rowCount;
+}
+
+QVariant SearchResultsModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid()) return QVariant();
+
+    if (m_groups.isEmpty()) {
+        return role == Qt::DisplayRole ? QVariant(m_message) : QVariant();
+    }
+    if (index.row() >= m_rowCount) return QVariant();
+
+    const Group& group = m_groups[groupAt(index.row())];
+    const int i = resultIndex(group, index.row());
+    if (i < 0) {
+        if (role == Qt::DisplayRole) {
+            return QStringLiteral("%1 (%2)").arg(QFileInfo(group.filepath).fileName()).arg(group.results.size());
+        }
+        if (role == Qt::ToolTipRole) return group.filepath;
+        if (role == Qt::FontRole) {
+            QFont font;
+            font.setBold(true);
+            return font;
+        }
+        return QVariant();
+    }
+
+    if (role != Qt::DisplayRole) return QVariant();
+    const SearchResult& result = group.results[group.order[i]];
+    if (result.distance > 0) {
+        const QString edits = result.distance == 1 ? QStringLiteral("1 edit") : QStringLiteral("%1 edits").arg(result.distance);
+        return QStringLiteral("Page %1 (%2): ...%3...").arg(result.pageNum + 1).arg(edits, result.context);
+    }
+    return QStringLiteral("Page %1: ...%2...").arg(result.pageNum + 1).arg(result.context);
+}
+
+Qt::ItemFlags SearchResultsModel::flags(const QModelIndex& index) const
+{
+    if (!isResult(index)) return Qt::ItemIsEnabled;
+    return QAbstractListModel::flags(index);
+}
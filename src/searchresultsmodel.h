@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QVector>
+#include <QHash>
+#include <QString>
+#include <QRectF>
+
+#include "document.h"
+
+// Search hits, grouped by file and shown through a QListView. Within a file, hits
+// are ranked by edit distance (only fuzzy searches have any) and then by position.
+// Rows only hold the SearchResult, which carries the context snippet the search cut
+// from the page text, so painting a row never touches a document. Hits are also
+// indexed by page, which is what highlighting and navigation on the current page
+// go through.
+class SearchResultsModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit SearchResultsModel(QObject* parent = nullptr);
+
+    // With file headers every file's hits are preceded by a row naming the file,
+    // which is how searches over several documents are shown.
+    void setFileHeaders(bool fileHeaders);
+
+    void clear();
+    void appendResults(const QString& filepath, const QVector<SearchResult>& results);
+
+    // A single row of text shown while there are no hits, e.g. "No results found.".
+    void setMessage(const QString& message);
+
+    bool hasResults() const;
+    bool isResult(const QModelIndex& index) const;
+    const SearchResult& result(int row) const;
+    QString filepath(int row) const;
+
+    // The closest result row after (step 1) or before (step -1) row, wrapping around.
+    int nextResultRow(int row, int step) const;
+
+    QVector<QRectF> locationsOnPage(const QString& filepath, int pageNum) const;
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    Qt::ItemFlags flags(const QModelIndex& index) const override;
+
+private:
+    struct Group {
+        QString filepath;
+        QVector<SearchResult> results;          // in arrival order
+        QVector<int> order;                     // row within the group -> index into results
+        QHash<int, QVector<int>> resultsByPage;
+        int firstRow = 0;
+    };
+
+    int groupAt(int row) const;
+    // Row within the group's results, or -1 for its header row.
+    int resultIndex(const Group& group, int row) const;
+    void insertRows(int g, int offset, int count);
+
+    bool m_fileHeaders;
+    QVector<Group> m_groups;
+    QHash<QString, int> m_groupIndex;
+    int m_rowCount;
+    QString m_message;
+};
@@ -0,0 +1,303 @@
+#include "searchsession.h"
+#include "searchjob.h"
+#include "textindex.h"
+
+#include <QtConcurrent>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QMutex>
+#include <QCache>
+#include <QDebug>
+#include <atomic>
+#include <numeric>
+
+static const int MaxRunningJobs = 4;
+// Books whose page count is remembered; a few hundred bytes each.
+static const int PageCountCacheSize = 8192;
+
+// What the library walk needs, shared with it so the session can go away while it
+// is still inside fz_open_document(). Whatever it finds after that is dropped.
+struct SearchSession::Scan
+{
+    fz_context* ctx;
+    QStringList uncountedPaths;
+    QStringList folders;
+    QSet<QString> skip;
+    std::atomic<bool> cancelled{ false };
+
+    QMutex mutex;
+    SearchSession* session = nullptr;   // cleared when the session is deleted
+};
+
+static const QStringList& librarySuffixes()
+{
+    static const QStringList suffixes = { "pdf", "epub", "xps", "cbz", "fb2" };
+    return suffixes;
+}
+
+struct CachedPageCount
+{
+    qint64 size;
+    QDateTime modified;
+    int pageCount;
+};
+
+// Remembered while the file's size and modification time stay the same, failures
+// included, so typing in a library search doesn't reopen every book per keystroke.
+// Only the most recently counted books are kept, so a library that keeps growing
+// doesn't grow the cache with it.
+// Otherwise taken from the text index when there is one, so indexed files are
+// never opened.
+static int countPages(fz_context* ctx, const QString& filepath)
+{
+    static QMutex cacheMutex;
+    static QCache<QString, CachedPageCount> cache(PageCountCacheSize);
+
+    const QFileInfo info(filepath);
+    {
+        QMutexLocker locker(&cacheMutex);
+        const CachedPageCount* cached = cache.object(filepath);
+        if (cached && cached->size == info.size() && cached->modified == info.lastModified()) {
+            return cached->pageCount;
+        }
+    }
+
+    int pageCount = 0;
+    const QByteArray fingerprint = TextIndex::fingerprint(filepath);
+    TextIndex index;
+    if (!fingerprint.isEmpty() && index.open(TextIndex::indexPathFor(fingerprint), fingerprint)) {
+        pageCount = index.pageCount();
+    } else {
+        fz_document* doc = nullptr;
+        fz_try(ctx) {
+            doc = fz_open_document(ctx, filepath.toStdString().c_str());
+            pageCount = fz_count_pages(ctx, doc);
+        } fz_catch(ctx) {
+            qWarning() << "Library search skipped" << filepath << ":" << fz_caught_message(ctx);
+            pageCount = 0;
+        }
+        if (doc) fz_drop_document(ctx, doc);
+    }
+
+    QMutexLocker locker(&cacheMutex);
+    cache.insert(filepath, new CachedPageCount{ info.size(), info.lastModified(), pageCount });
+    return pageCount;
+}
+
+SearchSession::SearchSession(fz_context* ctx, const QSharedPointer<const CompiledQuery>& query, QObject* parent)
+    : QObject(parent),
+    m_ctx(ctx),
+    m_query(query),
+    m_scanning(false),
+    m_needsScan(false),
+    m_started(false),
+    m_finished(false),
+    m_cancelled(false)
+{
+}
+
+SearchSession::~SearchSession()
+{
+    if (m_scan) {
+        m_scan->cancelled = true;
+        QMutexLocker locker(&m_scan->mutex);
+        m_scan->session = nullptr;
+    }
+    // Running jobs are children and cancel when deleted.
+}
+
+void SearchSession::addDocument(const QString& filepath, int pageCount)
+{
+    const QString path = QFileInfo(filepath).absoluteFilePath();
+    m_documentPaths.append(path);
+    if (m_knownFiles.contains(path) || m_uncountedPaths.contains(path)) return;
+    if (pageCount <= 0) {
+        m_uncountedPaths.append(path);
+        m_needsScan = true;
+        return;
+    }
+
+    m_knownFiles.insert(path);
+    File file;
+    file.filepath = path;
+    file.pageCount = pageCount;
+    m_files.append(file);
+    m_queue.append(m_files.size() - 1);
+}
+
+void SearchSession::addFolder(const QString& folder)
+{
+    if (folder.isEmpty()) return;
+    m_folders.append(QDir::cleanPath(folder));
+    m_needsScan = true;
+}
+
+bool SearchSession::refineFrom(const SearchSession& previous)
+{
+    if (m_started || !previous.m_started || previous.m_needsScan) return false;
+    if (m_documentPaths != previous.m_documentPaths || m_folders != previous.m_folders) return false;
+    if (!m_query->isRefinementOf(*previous.m_query)) return false;
+
+    m_files.clear();
+    m_queue.clear();
+    m_knownFiles = previous.m_knownFiles;
+    m_needsScan = false;
+    for (const File& previousFile : previous.m_files) {
+        File file = previousFile;
+        file.pages = previous.refinementPages(previousFile);
+        m_files.append(file);
+        if (file.pages.isEmpty()) {
+            m_finishedHitPages.insert(file.filepath, QVector<int>());
+        } else {
+            m_queue.append(m_files.size() - 1);
+        }
+    }
+    return true;
+}
+
+void SearchSession::start()
+{
+    m_started = true;
+    if (m_needsScan) {
+        m_scanning = true;
+        m_scan = QSharedPointer<Scan>::create();
+        m_scan->ctx = m_ctx;
+        m_scan->uncountedPaths = m_uncountedPaths;
+        m_scan->folders = m_folders;
+        m_scan->skip = m_knownFiles;
+        m_scan->session = this;
+        // On the search pool, as it borrows the base context like the search workers.
+        QtConcurrent::run(SearchJob::threadPool(), [scan = m_scan] { scanFolders(scan); });
+    }
+    startJobs();
+    QMetaObject::invokeMethod(this, [this] { maybeFinish(); }, Qt::QueuedConnection);
+}
+
+void SearchSession::cancel()
+{
+    m_cancelled = true;
+    if (m_scan) m_scan->cancelled = true;
+    for (auto it = m_running.cbegin(); it != m_running.cend(); ++it) {
+        it.key()->cancel();
+    }
+}
+
+void SearchSession::scanFolders(const QSharedPointer<Scan>& scanPointer)
+{
+    Scan& scan = *scanPointer;
+    fz_context* ctx = fz_clone_context(scan.ctx);
+    if (!ctx) {
+        qWarning() << "Failed to clone MuPDF context for library search";
+    }
+
+    QSet<QString> counted = scan.skip;
+    auto countFile = [&](const QString& path) {
+        if (counted.contains(path)) return;
+        counted.insert(path);
+        const int pageCount = countPages(ctx, path);
+        if (pageCount <= 0) return;
+
+        QMutexLocker locker(&scan.mutex);
+        if (SearchSession* session = scan.session) {
+            QMetaObject::invokeMethod(session, [session, path, pageCount] { session->fileFound(path, pageCount); }, Qt::QueuedConnection);
+        }
+    };
+
+    for (const QString& path : std::as_const(scan.uncountedPaths)) {
+        if (!ctx || scan.cancelled) break;
+        countFile(path);
+    }
+    for (const QString& folder : std::as_const(scan.folders)) {
+        QDirIterator it(folder, QDir::Files | QDir::Readable, QDirIterator::Subdirectories);
+        while (ctx && !scan.cancelled && it.hasNext()) {
+            const QFileInfo info(it.next());
+            if (!librarySuffixes().contains(info.suffix(), Qt::CaseInsensitive)) continue;
+
+            countFile(info.absoluteFilePath());
+        }
+    }
+
+    const bool complete = ctx && !scan.cancelled;
+    if (ctx) fz_drop_context(ctx);
+    QMutexLocker locker(&scan.mutex);
+    if (SearchSession* session = scan.session) {
+        QMetaObject::invokeMethod(session, [session, complete] { session->scanFinished(complete); }, Qt::QueuedConnection);
+    }
+}
+
+void SearchSession::scanFinished(bool complete)
+{
+    m_scanning = false;
+    // Only a walk over every folder lets a later session refine this one.
+    if (complete) m_needsScan = false;
+    maybeFinish();
+}
+
+void SearchSession::fileFound(const QString& filepath, int pageCount)
+{
+    if (m_knownFiles.contains(filepath)) return;
+
+    m_knownFiles.insert(filepath);
+    File file;
+    file.filepath = filepath;
+    file.pageCount = pageCount;
+    m_files.append(file);
+    m_queue.append(m_files.size() - 1);
+    startJobs();
+}
+
+void SearchSession::startJobs()
+{
+    if (m_cancelled) return;
+    while (m_running.size() < MaxRunningJobs && !m_queue.isEmpty()) {
+        const int fileIndex = m_queue.takeFirst();
+        const File& file = m_files[fileIndex];
+        const QString filepath = file.filepath;
+
+        SearchJob* job = new SearchJob(m_ctx, filepath, file.pageCount, m_query, this);
+        if (!file.pages.isEmpty()) {
+            job->restrictToPages(file.pages);
+        }
+        m_running.insert(job, fileIndex);
+        connect(job, &SearchJob::resultsFound, this, [this, filepath](const QVector<SearchResult>& results) {
+            emit resultsFound(filepath, results);
+        });
+        connect(job, &SearchJob::finished, this, [this, job] { jobFinished(job); });
+        job->start();
+    }
+}
+
+void SearchSession::jobFinished(SearchJob* job)
+{
+    const int fileIndex = m_running.take(job);
+    m_finishedHitPages.insert(m_files[fileIndex].filepath, job->refinementPages());
+    // Deleted later, as this runs from the job's own signal.
+    job->deleteLater();
+
+    startJobs();
+    maybeFinish();
+}
+
+void SearchSession::maybeFinish()
+{
+    if (m_finished || m_cancelled || m_scanning || !m_queue.isEmpty() || !m_running.isEmpty()) return;
+    m_finished = true;
+    emit finished();
+}
+
+QVector<int> SearchSession::refinementPages(const File& file) const
+{
+    if (auto it = m_finishedHitPages.constFind(file.filepath); it != m_finishedHitPages.cend()) {
+        return *it;
+    }
+    for (auto it = m_running.cbegin(); it != m_running.cend(); ++it) {
+        if (m_files[it.value()].filepath == file.filepath) return it.key()->refinementPages();
+    }
+    if (!file.pages.isEmpty()) return file.pages;
+
+    QVector<int> pages(file.pageCount);
+    std::iota(pages.begin(), pages.end(), 0);
+    return pages;
+}
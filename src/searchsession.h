@@ -0,0 +1,90 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QSharedPointer>
+#include <mupdf/fitz.h>
+
+#include "document.h"
+#include "searchquery.h"
+
+class SearchJob;
+
+// Runs one query over several files: documents that are already open, plus every
+// document found under library folders. Files are searched by SearchJobs, a few at
+// a time, each spreading its pages over the thread pool. Library folders are walked
+// on a background thread, and files stream into the queue as their page count is
+// known. Page counts are remembered across sessions, so only files that are new or
+// changed since the last search are opened to count them. Hits are reported per
+// file, in page order within each file. Deleting a session waits for nothing: the
+// walk stops at its next file and its jobs cancel.
+class SearchSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    SearchSession(fz_context* ctx, const QSharedPointer<const CompiledQuery>& query, QObject* parent = nullptr);
+    ~SearchSession();
+    SearchSession(const SearchSession&) = delete;
+    SearchSession& operator=(const SearchSession&) = delete;
+
+    // Sources have to be added before start(). A file added twice is searched once.
+    // Without a page count (e.g. a restored tab that was never opened), the file is
+    // counted on the background thread along with the library folders.
+    void addDocument(const QString& filepath, int pageCount);
+    void addFolder(const QString& folder);
+
+    // Reuses what the previous session found when it covered the same sources and
+    // this session's query can only match a subset of its hits: files it finished
+    // without a hit are skipped, and the others are searched only on the pages
+    // SearchJob::refinementPages() leaves. Must be called before start().
+    bool refineFrom(const SearchSession& previous);
+
+    void start();
+    // Stops the walk and the running jobs without waiting for either. What was
+    // searched so far still counts for refineFrom(); finished() is never emitted.
+    void cancel();
+
+signals:
+    void resultsFound(const QString& filepath, const QVector<SearchResult>& results);
+    void finished();
+
+private:
+    struct File {
+        QString filepath;
+        int pageCount = 0;
+        QVector<int> pages;     // empty for the whole document
+    };
+
+    struct Scan;
+
+    static void scanFolders(const QSharedPointer<Scan>& scan);
+    void fileFound(const QString& filepath, int pageCount);
+    void scanFinished(bool complete);
+    void startJobs();
+    void jobFinished(SearchJob* job);
+    void maybeFinish();
+    QVector<int> refinementPages(const File& file) const;
+
+    fz_context* m_ctx;
+    QSharedPointer<const CompiledQuery> m_query;
+    QStringList m_documentPaths;
+    QStringList m_folders;
+    QStringList m_uncountedPaths;
+    QList<File> m_files;
+    QSet<QString> m_knownFiles;
+    QList<int> m_queue;                     // indices into m_files
+    QHash<SearchJob*, int> m_running;       // job -> index into m_files
+    QHash<QString, QVector<int>> m_finishedHitPages;
+    QSharedPointer<Scan> m_scan;
+    bool m_scanning;
+    bool m_needsScan;       // until a scan has walked every folder
+    bool m_started;
+    bool m_finished;
+    bool m_cancelled;
+};
@@ -4,25 +4,31 @@
 #include <QPainter>
 #include <QApplication>
 #include <algorithm>
+#include <cmath>
 #include <utility>
 
+static const int CurrentHitPenWidth = 2;
+static const qreal PressSnapDistance = 3;
+
 SelectionLabel::SelectionLabel(QWidget* parent)
-    : QLabel(parent), m_isSelecting(false), m_startIndex(-1), m_endIndex(-1)
+    : QLabel(parent), m_isSelecting(false), m_zoomFactor(1.0), m_startIndex(-1), m_endIndex(-1)
 {
     setCursor(Qt::IBeamCursor);
 }
 
 void SelectionLabel::clearSelection()
 {
+    const QRegion dirty = regionOf(m_highlightRects);
     m_highlightRects.clear();
     m_startIndex = -1;
     m_endIndex = -1;
-    update();
+    update(dirty);
 }
 
-void SelectionLabel::setCharRects(const QVector<QRectF>& charRects)
+void SelectionLabel::setTextLayer(const QSharedPointer<const TextLayer>& layer, qreal zoomFactor)
 {
-    m_allCharRects = charRects;
+    m_textLayer = layer;
+    m_zoomFactor = zoomFactor;
 }
 
 bool SelectionLabel::hasSelection() const
@@ -30,30 +36,54 @@ bool SelectionLabel::hasSelection() const
     return !m_highlightRects.isEmpty();
 }
 
-int SelectionLabel::charIndexAt(const QPoint& pos)
+int SelectionLabel::charIndexAt(const QPoint& pos, qreal maxDistance) const
 {
-    for (int i = 0; i < m_allCharRects.size(); ++i) {
-        if (m_allCharRects[i].contains(pos)) {
-            return i;
-        }
+    if (!m_textLayer || m_zoomFactor <= 0) return -1;
+    const QPointF point = QPointF(pos) / m_zoomFactor;
+    const int glyph = m_textLayer->index.nearestGlyph(point);
+    if (glyph < 0 || std::isinf(maxDistance)) return glyph;
+
+    const QRectF box = m_textLayer->boxes.rect(glyph);
+    const qreal dx = std::max({ box.left() - point.x(), qreal(0), point.x() - box.right() });
+    const qreal dy = std::max({ box.top() - point.y(), qreal(0), point.y() - box.bottom() });
+    const qreal limit = maxDistance / m_zoomFactor;
+    return dx * dx + dy * dy <= limit * limit ? glyph : -1;
+}
+
+QRegion SelectionLabel::regionOf(const QVector<QRectF>& rects, int margin)
+{
+    QRegion region;
+    for (const QRectF& rect : rects) {
+        if (rect.isNull()) continue;
+        region += rect.toAlignedRect().adjusted(-margin, -margin, margin, margin);
     }
-    return -1;
+    return region;
 }
 
 void SelectionLabel::updateHighlightRects()
 {
-    m_highlightRects.clear();
-    if (m_startIndex == -1 || m_endIndex == -1) {
-        return;
+    QVector<QRectF> spans;
+    if (m_textLayer && m_startIndex != -1 && m_endIndex != -1) {
+        spans = m_textLayer->index.spanRects(std::min(m_startIndex, m_endIndex), std::max(m_startIndex, m_endIndex));
+        for (QRectF& span : spans) {
+            span = QRectF(span.topLeft() * m_zoomFactor, span.bottomRight() * m_zoomFactor);
+        }
     }
+    if (spans == m_highlightRects) return;
 
-    int start = std::min(m_startIndex, m_endIndex);
-    int end = std::max(m_startIndex, m_endIndex);
-
-    for (int i = start; i <= end; ++i) {
-        m_highlightRects.append(m_allCharRects[i]);
+    // Only lines whose span changed since the last move are repainted. Spans of
+    // neighbouring lines can overlap, so changes are found per span: xoring the
+    // unions would miss a span that changed where another one still covers it.
+    QVector<QRectF> changed;
+    for (const QRectF& span : std::as_const(m_highlightRects)) {
+        if (!spans.contains(span)) changed.append(span);
     }
-    update();
+    for (const QRectF& span : std::as_const(spans)) {
+        if (!m_highlightRects.contains(span)) changed.append(span);
+    }
+    const QRegion dirty = regionOf(changed);
+    m_highlightRects = spans;
+    update(dirty);
 }
 
 void SelectionLabel::mousePressEvent(QMouseEvent* event)
@@ -67,7 +97,7 @@ void SelectionLabel::mousePressEvent(QMouseEvent* event)
         } else {
             m_isSelecting = true;
             m_anchorPoint = event->pos();
-            m_startIndex = charIndexAt(event->pos());
+            m_startIndex = charIndexAt(event->pos(), PressSnapDistance);
             m_endIndex = m_startIndex;
             updateHighlightRects();
         }
@@ -77,6 +107,12 @@ void SelectionLabel::mousePressEvent(QMouseEvent* event)
 void SelectionLabel::mouseMoveEvent(QMouseEvent* event)
 {
     if (m_isSelecting) {
+        // A drag begun on blank space starts from the text nearest to where it
+        // began, once it has moved far enough not to be a click.
+        if (m_startIndex == -1) {
+            if ((event->pos() - m_anchorPoint).manhattanLength() < QApplication::startDragDistance()) return;
+            m_startIndex = charIndexAt(m_anchorPoint);
+        }
         m_endIndex = charIndexAt(event->pos());
         updateHighlightRects();
     }
@@ -92,7 +128,11 @@ void SelectionLabel::mouseReleaseEvent(QMouseEvent* /*event*/)
                 selectionBoundingRect = selectionBoundingRect.united(rect);
             }
         }
-        emit selectionMade(selectionBoundingRect.toRect());
+        if (selectionBoundingRect.isNull()) {
+            emit selectionMade(QRect(), -1, -1);
+        } else {
+            emit selectionMade(selectionBoundingRect.toRect(), std::min(m_startIndex, m_endIndex), std::max(m_startIndex, m_endIndex));
+        }
     }
 }
 
@@ -101,19 +141,41 @@ void SelectionLabel::paintEvent(QPaintEvent* event)
     QLabel::paintEvent(event);
 
     QPainter painter(this);
+
+    if (!m_pageImage.isNull()) {
+        painter.drawImage(event->rect(), m_pageDisplay, event->rect());
+    }
+
+    if (!m_preview.isNull() && width() > 0 && height() > 0) {
+        // Scale only the exposed part of the stand-in bitmap, never the whole page.
+        const qreal sx = qreal(m_preview.width()) / width();
+        const qreal sy = qreal(m_preview.height()) / height();
+        const QRectF target(event->rect());
+        const QRectF source(target.x() * sx, target.y() * sy, target.width() * sx, target.height() * sy);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(target, m_previewDisplay, source);
+    }
+
+    for (const Tile& tile : std::as_const(m_tiles)) {
+        if (tile.rect.intersects(event->rect())) {
+            painter.drawImage(tile.rect.topLeft(), tile.display);
+        }
+    }
+
     painter.setRenderHint(QPainter::Antialiasing);
+    const QRectF exposed = QRectF(event->rect()).adjusted(-CurrentHitPenWidth, -CurrentHitPenWidth, CurrentHitPenWidth, CurrentHitPenWidth);
 
     if (!m_searchHighlights.isEmpty()) {
         painter.setBrush(QColor(255, 255, 0, 70));
         painter.setPen(Qt::NoPen);
         for(const QRectF& rect : m_searchHighlights) {
-            painter.drawRect(rect);
+            if (rect.intersects(exposed)) painter.drawRect(rect);
         }
     }
 
-    if (!m_currentSearchHighlight.isNull()) {
+    if (!m_currentSearchHighlight.isNull() && m_currentSearchHighlight.intersects(exposed)) {
         painter.setBrush(QColor(255, 140, 0, 90));
-        painter.setPen(QPen(QColor(220, 20, 60), 2));
+        painter.setPen(QPen(QColor(220, 20, 60), CurrentHitPenWidth));
         painter.drawRect(m_currentSearchHighlight);
     }
 
@@ -121,23 +183,96 @@ void SelectionLabel::paintEvent(QPaintEvent* event)
         painter.setBrush(QColor(0, 100, 255, 70));
         painter.setPen(Qt::NoPen);
         for(const QRectF& rect : m_highlightRects) {
-            painter.drawRect(rect);
+            if (rect.intersects(exposed)) painter.drawRect(rect);
         }
     }
 }
 
 void SelectionLabel::setSearchHighlights(const QVector<QRectF>& allRects, const QRectF& currentRect)
 {
+    QRegion dirty = regionOf(m_searchHighlights) + regionOf({ m_currentSearchHighlight }, CurrentHitPenWidth);
     m_searchHighlights = allRects;
     m_currentSearchHighlight = currentRect;
-    update();
+    dirty += regionOf(m_searchHighlights) + regionOf({ m_currentSearchHighlight }, CurrentHitPenWidth);
+    update(dirty);
 }
 
 void SelectionLabel::clearSearchHighlight()
 {
     if (!m_searchHighlights.isEmpty() || !m_currentSearchHighlight.isNull()) {
+        const QRegion dirty = regionOf(m_searchHighlights) + regionOf({ m_currentSearchHighlight }, CurrentHitPenWidth);
         m_searchHighlights.clear();
         m_currentSearchHighlight = QRectF();
+        update(dirty);
+    }
+}
+
+void SelectionLabel::setColorFilter(const ColorFilter& filter)
+{
+    if (filter == m_colorFilter) return;
+
+    m_colorFilter = filter;
+    m_pageDisplay = m_colorFilter.apply(m_pageImage);
+    m_previewDisplay = m_colorFilter.apply(m_preview);
+    for (Tile& tile : m_tiles) {
+        tile.display = m_colorFilter.apply(tile.image);
+    }
+    update();
+}
+
+void SelectionLabel::setPageImage(const QImage& image)
+{
+    m_pageImage = image;
+    m_pageDisplay = m_colorFilter.apply(image);
+    update();
+}
+
+void SelectionLabel::setPreview(const QImage& image)
+{
+    m_preview = image;
+    m_previewDisplay = m_colorFilter.apply(image);
+    update();
+}
+
+void SelectionLabel::clearPreview()
+{
+    if (!m_preview.isNull()) {
+        m_preview = QImage();
+        m_previewDisplay = QImage();
+        update();
+    }
+}
+
+void SelectionLabel::setTile(const QRect& rect, const QImage& image)
+{
+    for (Tile& tile : m_tiles) {
+        if (tile.rect == rect) {
+            tile.image = image;
+            tile.display = m_colorFilter.apply(image);
+            update(rect);
+            return;
+        }
+    }
+    m_tiles.append({rect, image, m_colorFilter.apply(image)});
+    update(rect);
+}
+
+bool SelectionLabel::hasTile(const QRect& rect) const
+{
+    return std::any_of(m_tiles.cbegin(), m_tiles.cend(), [&](const Tile& tile) { return tile.rect == rect; });
+}
+
+void SelectionLabel::pruneTiles(const QRect& keepRect)
+{
+    m_tiles.erase(std::remove_if(m_tiles.begin(), m_tiles.end(), [&](const Tile& tile) {
+        return !tile.rect.intersects(keepRect);
+    }), m_tiles.end());
+}
+
+void SelectionLabel::clearTiles()
+{
+    if (!m_tiles.isEmpty()) {
+        m_tiles.clear();
         update();
     }
 }
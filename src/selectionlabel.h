@@ -4,6 +4,13 @@
 #include <QRect>
 #include <QPoint>
 #include <QVector>
+#include <QImage>
+#include <QRegion>
+#include <QSharedPointer>
+#include <limits>
+
+#include "colorfilter.h"
+#include "textlayer.h"
 
 class QMouseEvent;
 class QPaintEvent;
@@ -16,14 +23,31 @@ public:
     explicit SelectionLabel(QWidget* parent = nullptr);
 
     void clearSelection();
-    void setCharRects(const QVector<QRectF>& charRects);
+    // Glyph geometry stays in page space; the zoom is applied as the mouse is
+    // tracked and the selection drawn.
+    void setTextLayer(const QSharedPointer<const TextLayer>& layer, qreal zoomFactor);
     bool hasSelection() const;
 
     void setSearchHighlights(const QVector<QRectF>& allRects, const QRectF& currentRect);
     void clearSearchHighlight();
 
+    // Images are kept as rendered; the filter is applied once per image when it is
+    // handed in, and again to everything on screen when the filter changes.
+    void setColorFilter(const ColorFilter& filter);
+    void setPageImage(const QImage& image);
+
+    void setPreview(const QImage& image);
+    void clearPreview();
+
+    void setTile(const QRect& rect, const QImage& image);
+    bool hasTile(const QRect& rect) const;
+    void pruneTiles(const QRect& keepRect);
+    void clearTiles();
+
 signals:
-    void selectionMade(const QRect& selectionRect);
+    // firstGlyph..lastGlyph index the text layer, in reading order; both are -1
+    // when nothing is selected.
+    void selectionMade(const QRect& selectionRect, int firstGlyph, int lastGlyph);
 
 protected:
     void mousePressEvent(QMouseEvent* event) override;
@@ -32,18 +56,35 @@ protected:
     void paintEvent(QPaintEvent* event) override;
 
 private:
-    int charIndexAt(const QPoint& pos);
+    // Snaps to the nearest glyph, so dragging across gaps between words and lines
+    // keeps extending the selection. A glyph further than maxDistance pixels away
+    // doesn't count, which is how a click on blank space selects nothing.
+    int charIndexAt(const QPoint& pos, qreal maxDistance = std::numeric_limits<qreal>::infinity()) const;
     void updateHighlightRects();
+    static QRegion regionOf(const QVector<QRectF>& rects, int margin = 0);
 
     QPoint m_origin;
     QPoint m_anchorPoint;
     bool m_isSelecting;
 
-    QVector<QRectF> m_allCharRects;
-    QVector<QRectF> m_highlightRects;
+    QSharedPointer<const TextLayer> m_textLayer;
+    qreal m_zoomFactor;
+    QVector<QRectF> m_highlightRects;      // one span per selected line
     QVector<QRectF> m_searchHighlights;
     QRectF          m_currentSearchHighlight;
 
     int m_startIndex;
     int m_endIndex;
+
+    struct Tile {
+        QRect rect;
+        QImage image;
+        QImage display;
+    };
+    QVector<Tile> m_tiles;
+    QImage m_pageImage;
+    QImage m_pageDisplay;
+    QImage m_preview;
+    QImage m_previewDisplay;
+    ColorFilter m_colorFilter;
 };
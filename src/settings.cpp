@@ -4,6 +4,7 @@
 #include <QScreen>
 #include <QColor>
 #include <QCoreApplication>
+#include <algorithm>
 
 QRect defaultGeometry() {
     return QGuiApplication::primaryScreen()->availableGeometry();
@@ -15,8 +16,14 @@ void AppSettings::load()
     QSettings settings(settingsPath, QSettings::IniFormat);
 
     isStatusBarVisible = settings.value("UI/isStatusBarVisible", true).toBool();
-    zoomFactor = settings.value("View/zoomFactor", 1.0).toReal();
-    invertPageColors = settings.value("View/invertPageColors", false).toBool();
+    zoomFactor = qRound(settings.value("View/zoomFactor", 1.0).toReal() * 100) / 100.0;
+    // Older settings files only know about inversion.
+    const int legacyMode = int(settings.value("View/invertPageColors", false).toBool() ? ColorMode::Invert : ColorMode::Normal);
+    colorMode = ColorMode(std::clamp(settings.value("View/colorMode", legacyMode).toInt(), int(ColorMode::Normal), int(ColorMode::Custom)));
+    customPaperColor = settings.value("View/customPaperColor", QColor(30, 31, 34)).value<QColor>();
+    customInkColor = settings.value("View/customInkColor", QColor(200, 200, 200)).value<QColor>();
+    pageCacheSizeMB = std::max(16, settings.value("Performance/pageCacheSizeMB", 100).toInt());
+    textIndexSizeMB = std::max(16, settings.value("Performance/textIndexSizeMB", 512).toInt());
     isMaximized = settings.value("Window/isMaximized", false).toBool();
     windowSize = settings.value("Window/size", defaultGeometry().size() * 0.8).toSize();
     windowPosition = settings.value("Window/position", defaultGeometry().center() - QPoint(windowSize.width()/2, windowSize.height()/2)).toPoint();
@@ -24,6 +31,9 @@ void AppSettings::load()
     lastOpenTabs = settings.value("Session/lastOpenTabs").toList();
     favoriteFiles = settings.value("Session/favoriteFiles").toStringList();
     notesDirectory = settings.value("General/notesDirectory", "").toString();
+    libraryFolder = settings.value("General/libraryFolder", "").toString();
+    fuzzySearchDistance = std::clamp(settings.value("General/fuzzySearchDistance", 1).toInt(), 1, 5);
+    matchDiacritics = settings.value("General/matchDiacritics", false).toBool();
 }
 
 void AppSettings::save()
@@ -33,14 +43,27 @@ void AppSettings::save()
 
     settings.setValue("UI/isStatusBarVisible", isStatusBarVisible);
     settings.setValue("View/zoomFactor", zoomFactor);
-    settings.setValue("View/invertPageColors", invertPageColors);
+    settings.remove("View/invertPageColors");
+    settings.setValue("View/colorMode", int(colorMode));
+    settings.setValue("View/customPaperColor", customPaperColor);
+    settings.setValue("View/customInkColor", customInkColor);
+    settings.setValue("Performance/pageCacheSizeMB", pageCacheSizeMB);
+    settings.setValue("Performance/textIndexSizeMB", textIndexSizeMB);
     settings.setValue("Session/recentFiles", recentFiles);
     settings.setValue("Session/lastOpenTabs", lastOpenTabs);
     settings.setValue("Session/favoriteFiles", favoriteFiles);
     settings.setValue("General/notesDirectory", notesDirectory);
+    settings.setValue("General/libraryFolder", libraryFolder);
+    settings.setValue("General/fuzzySearchDistance", fuzzySearchDistance);
+    settings.setValue("General/matchDiacritics", matchDiacritics);
     settings.setValue("Window/isMaximized", isMaximized);
     if (!isMaximized) {
         settings.setValue("Window/size", windowSize);
         settings.setValue("Window/position", windowPosition);
     }
 }
+
+ColorFilter AppSettings::pageColorFilter() const
+{
+    return ColorFilter::forMode(colorMode, customPaperColor, customInkColor);
+}
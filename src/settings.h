@@ -7,15 +7,22 @@
 #include <QStringList>
 #include <QVariantList>
 
+#include "colorfilter.h"
+
 class AppSettings
 {
 public:
     void load();
     void save();
+    ColorFilter pageColorFilter() const;
 
     bool isStatusBarVisible;
     qreal zoomFactor;
-    bool invertPageColors;
+    ColorMode colorMode;
+    QColor customPaperColor;
+    QColor customInkColor;
+    int pageCacheSizeMB;
+    int textIndexSizeMB;
 
     QSize windowSize;
     QPoint windowPosition;
@@ -25,4 +32,7 @@ public:
     QVariantList lastOpenTabs;
     QStringList favoriteFiles;
     QString notesDirectory;
+    QString libraryFolder;
+    int fuzzySearchDistance;
+    bool matchDiacritics;
 };
@@ -0,0 +1,294 @@
+#include "textindex.h"
+#include "textnormalizer.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QSaveFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+
+static const char IndexMagic[4] = { 'E', 'R', 'T', 'I' };
+static const quint32 IndexVersion = 3;
+static const qint64 FingerprintChunk = 64 * 1024;
+static const qint64 FingerprintSample = 4 * 1024;
+static const int FingerprintSamples = 32;
+
+struct TextIndex::Header
+{
+    char magic[4];
+    quint32 version;
+    char fingerprint[20];
+    quint32 pageCount;
+    quint64 rawOffset;
+    quint64 boxesOffset;
+    quint64 normalizedOffset;
+    quint64 mapOffset;
+    quint64 rawUnits;
+    quint64 normalizedUnits;
+};
+
+struct TextIndex::PageEntry
+{
+    quint32 rawStart;
+    quint32 rawLength;
+    quint32 normalizedStart;
+    quint32 normalizedLength;
+};
+
+IndexedBox IndexedBox::fromRect(const QRectF& rect)
+{
+    auto quantize = [](qreal v) { return quint16(std::clamp(qRound(v * 4), 0, 0xffff)); };
+    return { quantize(rect.left()), quantize(rect.top()), quantize(rect.right()), quantize(rect.bottom()) };
+}
+
+QRectF IndexedBox::toRect() const
+{
+    return QRectF(x0 / 4.0, y0 / 4.0, (x1 - x0) / 4.0, (y1 - y0) / 4.0);
+}
+
+QString PageText::normalize(const QString& text)
+{
+    return TextNormalizer::normalize(text).text;
+}
+
+PageText PageText::fromTextLayer(const TextLayer& layer)
+{
+    PageText page;
+    page.raw.reserve(layer.glyphCount() + layer.lineCount());
+    page.boxes.reserve(layer.glyphCount() + layer.lineCount());
+    for (int line = 0; line < layer.lineCount(); ++line) {
+        for (int g = layer.lineStarts[line]; g < layer.lineEnd(line); ++g) {
+            const char32_t c = layer.chars[g] <= 0x10ffff ? layer.chars[g] : char32_t(QChar::ReplacementCharacter);
+            const IndexedBox box = IndexedBox::fromRect(layer.boxes.rect(g));
+            if (QChar::requiresSurrogates(c)) {
+                page.raw.append(QChar(QChar::highSurrogate(c)));
+                page.raw.append(QChar(QChar::lowSurrogate(c)));
+                page.boxes.append(box);
+            } else {
+                page.raw.append(QChar(char16_t(c)));
+            }
+            page.boxes.append(box);
+        }
+        page.raw.append(QLatin1Char(' '));
+        page.boxes.append(IndexedBox());
+    }
+
+    NormalizedText normalized = TextNormalizer::normalize(page.raw);
+    page.normalized = std::move(normalized.text);
+    page.normalizedToRaw = std::move(normalized.sourceIndex);
+    return page;
+}
+
+PageTextView PageText::view() const
+{
+    return { QStringView(raw), boxes.constData(), QStringView(normalized), normalizedToRaw.constData() };
+}
+
+TextIndex::TextIndex()
+    : m_data(nullptr),
+    m_header(nullptr),
+    m_pages(nullptr)
+{
+}
+
+TextIndex::~TextIndex()
+{
+    if (m_data) m_file.unmap(const_cast<uchar*>(m_data));
+}
+
+QByteArray TextIndex::fingerprint(const QString& filepath)
+{
+    // Size, modification time, the head and tail of the file and evenly spaced
+    // samples between them: cheap to compute on every search, yet an editor that
+    // rewrites a few bytes in place still changes the mtime. A rename keeps it.
+    QFile file(filepath);
+    if (!file.open(QIODevice::ReadOnly)) return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    const qint64 size = file.size();
+    hash.addData(QByteArray::number(size));
+    hash.addData(QByteArray::number(QFileInfo(file).lastModified().toMSecsSinceEpoch()));
+    hash.addData(file.read(FingerprintChunk));
+    if (size > 2 * FingerprintChunk) {
+        const qint64 span = size - 2 * FingerprintChunk;
+        for (int i = 0; i < FingerprintSamples; ++i) {
+            file.seek(FingerprintChunk + span * i / FingerprintSamples);
+            hash.addData(file.read(FingerprintSample));
+        }
+    }
+    if (size > FingerprintChunk) {
+        file.seek(std::max(FingerprintChunk, size - FingerprintChunk));
+        hash.addData(file.read(FingerprintChunk));
+    }
+    return hash.result();
+}
+
+static QString indexDirectory()
+{
+    return QCoreApplication::applicationDirPath() + "/index";
+}
+
+QString TextIndex::indexPathFor(const QByteArray& fingerprint)
+{
+    return indexDirectory() + "/" + QString::fromLatin1(fingerprint.toHex()) + ".idx";
+}
+
+void TextIndex::prune(qint64 maxBytes)
+{
+    // Newest first; opening an index refreshes its modification time, so this is
+    // least recently used last.
+    const QFileInfoList files = QDir(indexDirectory()).entryInfoList({ QStringLiteral("*.idx") }, QDir::Files, QDir::Time);
+    qint64 total = 0;
+    for (const QFileInfo& info : files) {
+        total += info.size();
+        if (total <= maxBytes) continue;
+        // An index a search has mapped can't be removed on Windows; it goes next time.
+        if (QFile::remove(info.absoluteFilePath())) {
+            total -= info.size();
+        }
+    }
+}
+
+bool TextIndex::write(const QString& indexPath, const QByteArray& fingerprint, const QVector<PageText>& pages)
+{
+    if (fingerprint.size() != int(sizeof(Header::fingerprint))) return false;
+
+    Header header;
+    std::memcpy(header.magic, IndexMagic, sizeof(IndexMagic));
+    header.version = IndexVersion;
+    std::memcpy(header.fingerprint, fingerprint.constData(), sizeof(header.fingerprint));
+    header.pageCount = quint32(pages.size());
+
+    QVector<PageEntry> entries;
+    entries.reserve(pages.size());
+    quint64 rawUnits = 0;
+    quint64 normalizedUnits = 0;
+    for (const PageText& page : pages) {
+        entries.append({ quint32(rawUnits), quint32(page.raw.size()), quint32(normalizedUnits), quint32(page.normalized.size()) });
+        rawUnits += page.raw.size();
+        normalizedUnits += page.normalized.size();
+    }
+    if (rawUnits > 0xffffffffu || normalizedUnits > 0xffffffffu) return false;
+
+    // Sections are 8-byte aligned so the mapped arrays can be read in place.
+    auto align = [](quint64 offset) { return (offset + 7) & ~quint64(7); };
+    header.rawUnits = rawUnits;
+    header.normalizedUnits = normalizedUnits;
+    header.rawOffset = align(sizeof(Header) + entries.size() * sizeof(PageEntry));
+    header.boxesOffset = align(header.rawOffset + rawUnits * sizeof(char16_t));
+    header.normalizedOffset = align(header.boxesOffset + rawUnits * sizeof(IndexedBox));
+    header.mapOffset = align(header.normalizedOffset + normalizedUnits * sizeof(char16_t));
+
+    QDir().mkpath(QFileInfo(indexPath).absolutePath());
+    QSaveFile file(indexPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to write text index" << indexPath << ":" << file.errorString();
+        return false;
+    }
+
+    auto padTo = [&file](quint64 offset) {
+        const qint64 padding = qint64(offset) - file.pos();
+        if (padding > 0) file.write(QByteArray(padding, '\0'));
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.constData()), entries.size() * sizeof(PageEntry));
+    padTo(header.rawOffset);
+    for (const PageText& page : pages) {
+        file.write(reinterpret_cast<const char*>(page.raw.utf16()), page.raw.size() * sizeof(char16_t));
+    }
+    padTo(header.boxesOffset);
+    for (const PageText& page : pages) {
+        file.write(reinterpret_cast<const char*>(page.boxes.constData()), page.boxes.size() * sizeof(IndexedBox));
+    }
+    padTo(header.normalizedOffset);
+    for (const PageText& page : pages) {
+        file.write(reinterpret_cast<const char*>(page.normalized.utf16()), page.normalized.size() * sizeof(char16_t));
+    }
+    padTo(header.mapOffset);
+    for (const PageText& page : pages) {
+        file.write(reinterpret_cast<const char*>(page.normalizedToRaw.constData()), page.normalizedToRaw.size() * sizeof(quint32));
+    }
+    return file.commit();
+}
+
+bool TextIndex::open(const QString& indexPath, const QByteArray& fingerprint)
+{
+    if (m_data || fingerprint.size() != int(sizeof(Header::fingerprint))) return false;
+
+    m_file.setFileName(indexPath);
+    if (!m_file.open(QIODevice::ReadOnly)) return false;
+
+    const qint64 size = m_file.size();
+    const uchar* data = size >= qint64(sizeof(Header)) ? m_file.map(0, size) : nullptr;
+    if (!data) {
+        m_file.close();
+        return false;
+    }
+
+    const Header* header = reinterpret_cast<const Header*>(data);
+    const quint64 pagesEnd = sizeof(Header) + quint64(header->pageCount) * sizeof(PageEntry);
+    const bool valid = std::memcmp(header->magic, IndexMagic, sizeof(IndexMagic)) == 0
+        && header->version == IndexVersion
+        && std::memcmp(header->fingerprint, fingerprint.constData(), sizeof(header->fingerprint)) == 0
+        && pagesEnd <= header->rawOffset
+        && header->rawOffset + header->rawUnits * sizeof(char16_t) <= header->boxesOffset
+        && header->boxesOffset + header->rawUnits * sizeof(IndexedBox) <= header->normalizedOffset
+        && header->normalizedOffset + header->normalizedUnits * sizeof(char16_t) <= header->mapOffset
+        && header->mapOffset + header->normalizedUnits * sizeof(quint32) <= quint64(size);
+    if (!valid) {
+        m_file.unmap(const_cast<uchar*>(data));
+        m_file.close();
+        return false;
+    }
+
+    const PageEntry* pages = reinterpret_cast<const PageEntry*>(data + sizeof(Header));
+    for (quint32 i = 0; i < header->pageCount; ++i) {
+        if (quint64(pages[i].rawStart) + pages[i].rawLength > header->rawUnits
+            || quint64(pages[i].normalizedStart) + pages[i].normalizedLength > header->normalizedUnits) {
+            m_file.unmap(const_cast<uchar*>(data));
+            m_file.close();
+            return false;
+        }
+    }
+
+    m_data = data;
+    m_header = header;
+    m_pages = pages;
+
+    // Marks the index as used for prune(). Once a day is enough to order them.
+    const QDateTime now = QDateTime::currentDateTime();
+    if (m_file.fileTime(QFileDevice::FileModificationTime).daysTo(now) >= 1) {
+        QFile touch(indexPath);
+        if (touch.open(QIODevice::ReadWrite)) touch.setFileTime(now, QFileDevice::FileModificationTime);
+    }
+    return true;
+}
+
+bool TextIndex::isOpen() const
+{
+    return m_data != nullptr;
+}
+
+int TextIndex::pageCount() const
+{
+    return m_header ? int(m_header->pageCount) : 0;
+}
+
+PageTextView TextIndex::page(int pageNum) const
+{
+    if (!m_header || pageNum < 0 || pageNum >= pageCount()) return PageTextView();
+
+    const PageEntry& entry = m_pages[pageNum];
+    const char16_t* raw = reinterpret_cast<const char16_t*>(m_data + m_header->rawOffset);
+    const IndexedBox* boxes = reinterpret_cast<const IndexedBox*>(m_data + m_header->boxesOffset);
+    const char16_t* normalized = reinterpret_cast<const char16_t*>(m_data + m_header->normalizedOffset);
+    const quint32* map = reinterpret_cast<const quint32*>(m_data + m_header->mapOffset);
+
+    // Map entries are stored relative to the page's first raw unit.
+    return { QStringView(raw + entry.rawStart, entry.rawLength), boxes + entry.rawStart,
+             QStringView(normalized + entry.normalizedStart, entry.normalizedLength), map + entry.normalizedStart };
+}
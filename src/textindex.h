@@ -0,0 +1,81 @@
+#pragma once
+
+#include <QString>
+#include <QStringView>
+#include <QByteArray>
+#include <QVector>
+#include <QRectF>
+#include <QFile>
+
+#include "textlayer.h"
+
+// Glyph box in page space, in quarter points. Eight bytes instead of the 32 a
+// QRectF takes, which is what keeps the index of a large book small.
+struct IndexedBox
+{
+    quint16 x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    static IndexedBox fromRect(const QRectF& rect);
+    QRectF toRect() const;
+    bool isEmpty() const { return x1 <= x0 || y1 <= y0; }
+};
+
+// One page in the form it is searched: the raw text (a space closes every line)
+// with a box per UTF-16 unit, and the normalised text searches run over with a
+// map from each of its units back to the raw unit it came from. Normalising can
+// change the length (a decomposed accent disappears), hence the map.
+struct PageTextView
+{
+    QStringView raw;
+    const IndexedBox* boxes = nullptr;
+    QStringView normalized;
+    const quint32* normalizedToRaw = nullptr;
+};
+
+struct PageText
+{
+    QString raw;
+    QVector<IndexedBox> boxes;
+    QString normalized;
+    QVector<quint32> normalizedToRaw;
+
+    static PageText fromTextLayer(const TextLayer& layer);
+    static QString normalize(const QString& text);
+    PageTextView view() const;
+};
+
+// Memory-mapped, page-ordered text of a whole document, stored under a
+// fingerprint of the file's contents and modification time so an edited file
+// simply misses and is indexed again. Read-only once opened, so search workers
+// share one instance. Indexes of edited, copied or deleted books are never looked
+// up again; prune() drops the least recently used ones once the directory
+// outgrows its budget.
+class TextIndex
+{
+public:
+    TextIndex();
+    ~TextIndex();
+    TextIndex(const TextIndex&) = delete;
+    TextIndex& operator=(const TextIndex&) = delete;
+
+    static QByteArray fingerprint(const QString& filepath);
+    static QString indexPathFor(const QByteArray& fingerprint);
+    static bool write(const QString& indexPath, const QByteArray& fingerprint, const QVector<PageText>& pages);
+    // Deletes the indexes used longest ago until the rest fit in maxBytes. Does
+    // file I/O over the whole directory, so it belongs on a worker thread.
+    static void prune(qint64 maxBytes);
+
+    bool open(const QString& indexPath, const QByteArray& fingerprint);
+    bool isOpen() const;
+    int pageCount() const;
+    PageTextView page(int pageNum) const;
+
+private:
+    struct Header;
+    struct PageEntry;
+
+    QFile m_file;
+    const uchar* m_data;
+    const Header* m_header;
+    const PageEntry* m_pages;
+};
@@ -0,0 +1,52 @@
+#include "textlayer.h"
+#include <algorithm>
+
+QSharedPointer<const TextLayer> TextLayer::fromStextPage(fz_stext_page* stextPage)
+{
+    auto layer = QSharedPointer<TextLayer>::create();
+    for (fz_stext_block* block = stextPage->first_block; block; block = block->next) {
+        if (block->type != FZ_STEXT_BLOCK_TEXT) continue;
+        layer->blockStarts.append(layer->lineStarts.size());
+        for (fz_stext_line* line = block->u.t.first_line; line; line = line->next) {
+            layer->lineStarts.append(layer->chars.size());
+            for (fz_stext_char* ch = line->first_char; ch; ch = ch->next) {
+                fz_rect r = fz_rect_from_quad(ch->quad);
+                layer->chars.append(static_cast<char32_t>(ch->c));
+                layer->boxes.append(QRectF(r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0));
+            }
+        }
+    }
+    layer->index = GlyphIndex(layer->boxes);
+    return layer;
+}
+
+int TextLayer::glyphCount() const { return chars.size(); }
+int TextLayer::lineCount() const { return lineStarts.size(); }
+
+int TextLayer::lineEnd(int line) const
+{
+    return (line + 1 < lineStarts.size()) ? lineStarts[line + 1] : chars.size();
+}
+
+QString TextLayer::text(int firstGlyph, int lastGlyph) const
+{
+    QString result;
+    if (firstGlyph < 0 || lastGlyph >= chars.size() || firstGlyph > lastGlyph) return result;
+
+    int line = int(std::upper_bound(lineStarts.cbegin(), lineStarts.cend(), firstGlyph) - lineStarts.cbegin()) - 1;
+    result.reserve(lastGlyph - firstGlyph + 1);
+    for (int i = firstGlyph; i <= lastGlyph; ++i) {
+        while (line + 1 < lineStarts.size() && lineStarts[line + 1] <= i) {
+            ++line;
+            result.append(QLatin1Char('\n'));
+        }
+        const char32_t c = chars[i] <= 0x10ffff ? chars[i] : char32_t(QChar::ReplacementCharacter);
+        if (QChar::requiresSurrogates(c)) {
+            result.append(QChar(QChar::highSurrogate(c)));
+            result.append(QChar(QChar::lowSurrogate(c)));
+        } else {
+            result.append(QChar(char16_t(c)));
+        }
+    }
+    return result;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QSharedPointer>
+#include <QVector>
+#include <QRectF>
+#include <QString>
+#include <mupdf/fitz.h>
+
+#include "glyphindex.h"
+
+// A compact, MuPDF-independent copy of a page's structured text. It is extracted
+// once per page and then shared by selection, copy and search, so none of them
+// has to reload the page or rebuild an fz_stext_page. Everything is in page
+// space; callers apply the zoom, so a zoom change never extracts text again.
+struct TextLayer
+{
+    QVector<char32_t> chars;    // one code point per glyph, in reading order
+    GlyphBoxes boxes;           // parallel to chars
+    QVector<int> lineStarts;    // glyph index at which each line begins
+    QVector<int> blockStarts;   // line index at which each text block begins
+    GlyphIndex index;           // over boxes
+
+    static QSharedPointer<const TextLayer> fromStextPage(fz_stext_page* stextPage);
+
+    int glyphCount() const;
+    int lineCount() const;
+    int lineEnd(int line) const;
+    // Glyphs firstGlyph..lastGlyph with a newline between lines; linear in the
+    // length of the range.
+    QString text(int firstGlyph, int lastGlyph) const;
+};
@@ -0,0 +1,101 @@
+#include "textnormalizer.h"
+
+#include <QtAlgorithms>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTNORMALIZER_SSE2
+#endif
+
+static void appendCodePoint(char32_t c, quint32 source, TextNormalizer::Options options, NormalizedText& out)
+{
+    if (options & TextNormalizer::StripDiacritics) {
+        if (QChar::category(c) == QChar::Mark_NonSpacing) return;
+        if (QChar::decompositionTag(c) == QChar::Canonical) {
+            // Qt decomposes one level at a time, e.g. U+1EA5 only down to U+00E2 U+0301.
+            const QList<uint> parts = QChar::decomposition(c).toUcs4();
+            for (uint part : parts) {
+                appendCodePoint(part, source, options, out);
+            }
+            return;
+        }
+    }
+
+    if (options & TextNormalizer::CaseFold) {
+        c = QChar::toCaseFolded(c);
+    }
+    if (QChar::requiresSurrogates(c)) {
+        out.text.append(QChar(QChar::highSurrogate(c)));
+        out.text.append(QChar(QChar::lowSurrogate(c)));
+        out.sourceIndex.append(source);
+    } else {
+        out.text.append(QChar(char16_t(c)));
+    }
+    out.sourceIndex.append(source);
+}
+
+NormalizedText TextNormalizer::normalize(QStringView source, Options options)
+{
+    NormalizedText result;
+    result.text.reserve(source.size());
+    result.sourceIndex.reserve(source.size());
+
+    const qsizetype size = source.size();
+    for (qsizetype i = 0; i < size; ) {
+        const quint32 start = quint32(i);
+        const char16_t unit = source[i++].unicode();
+
+        // Page text is mostly ASCII, which needs neither table lookups nor decomposition.
+        if (unit < 0x80) {
+            const bool upper = (options & CaseFold) && unit >= 'A' && unit <= 'Z';
+            result.text.append(QChar(char16_t(upper ? unit + ('a' - 'A') : unit)));
+            result.sourceIndex.append(start);
+            continue;
+        }
+
+        char32_t c = unit;
+        if (QChar::isHighSurrogate(unit) && i < size && QChar::isLowSurrogate(source[i].unicode())) {
+            c = QChar::surrogateToUcs4(unit, source[i++].unicode());
+        }
+        appendCodePoint(c, start, options, result);
+    }
+    return result;
+}
+
+qsizetype TextNormalizer::find(QStringView haystack, QStringView needle, qsizetype from)
+{
+    const qsizetype n = haystack.size();
+    const qsizetype m = needle.size();
+    if (m == 0 || from < 0 || n - from < m) return -1;
+
+    const char16_t* h = haystack.utf16();
+    const char16_t* p = needle.utf16();
+    const char16_t first = p[0];
+    const char16_t last = p[m - 1];
+    const size_t middleBytes = m > 2 ? size_t(m - 2) * sizeof(char16_t) : 0;
+
+    qsizetype i = from;
+#ifdef TEXTNORMALIZER_SSE2
+    const __m128i firstUnits = _mm_set1_epi16(short(first));
+    const __m128i lastUnits = _mm_set1_epi16(short(last));
+    for (; i + m - 1 + 8 <= n; i += 8) {
+        const __m128i atFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+        const __m128i atLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i + m - 1));
+        const __m128i hits = _mm_and_si128(_mm_cmpeq_epi16(atFirst, firstUnits), _mm_cmpeq_epi16(atLast, lastUnits));
+        // Two mask bits per 16-bit lane; keep one.
+        uint mask = uint(_mm_movemask_epi8(hits)) & 0x5555u;
+        while (mask) {
+            const qsizetype pos = i + qCountTrailingZeroBits(mask) / 2;
+            if (std::memcmp(h + pos + 1, p + 1, middleBytes) == 0) return pos;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + m <= n; ++i) {
+        if (h[i] == first && h[i + m - 1] == last && std::memcmp(h + i + 1, p + 1, middleBytes) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
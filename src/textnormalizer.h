@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QString>
+#include <QStringView>
+#include <QVector>
+#include <QFlags>
+
+struct NormalizedText
+{
+    QString text;
+    QVector<quint32> sourceIndex;   // per unit of text: the source unit it came from
+};
+
+// Folds text into the form searches compare: full code points (never truncated
+// to a single UTF-16 unit), simple case folding and, optionally, diacritics
+// removed through canonical decomposition. Query and page text go through the
+// same function once, so the matcher itself is a plain exact substring search.
+class TextNormalizer
+{
+public:
+    enum Option {
+        CaseFold = 0x1,
+        StripDiacritics = 0x2
+    };
+    Q_DECLARE_FLAGS(Options, Option)
+
+    static NormalizedText normalize(QStringView source, Options options = Options(CaseFold | StripDiacritics));
+
+    // Exact search over normalised text. Candidates are filtered eight units at a
+    // time on the needle's first and last unit (SSE2), and only those are compared.
+    static qsizetype find(QStringView haystack, QStringView needle, qsizetype from = 0);
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(TextNormalizer::Options)
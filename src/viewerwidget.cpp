@@ -1,14 +1,13 @@
 #include "viewerwidget.h"
 #include "selectionlabel.h"
-#include <QPixmap>
 #include <QScrollBar>
+#include <QResizeEvent>
 
-ViewerWidget::ViewerWidget(QWidget *parent) : QScrollArea(parent)
+ViewerWidget::ViewerWidget(QWidget *parent) : QScrollArea(parent), m_isTiled(false)
 {
     m_imageLabel = new SelectionLabel;
     m_imageLabel->setBackgroundRole(QPalette::Base);
     m_imageLabel->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
-    m_imageLabel->setScaledContents(true);
 
     setWidget(m_imageLabel);
     setBackgroundRole(QPalette::Dark);
@@ -16,6 +15,14 @@ ViewerWidget::ViewerWidget(QWidget *parent) : QScrollArea(parent)
     setWidgetResizable(false);
 
     connect(m_imageLabel, &SelectionLabel::selectionMade, this, &ViewerWidget::textSelected);
+    connect(horizontalScrollBar(), &QScrollBar::valueChanged, this, &ViewerWidget::viewportChanged);
+    connect(verticalScrollBar(), &QScrollBar::valueChanged, this, &ViewerWidget::viewportChanged);
+}
+
+void ViewerWidget::resizeEvent(QResizeEvent *event)
+{
+    QScrollArea::resizeEvent(event);
+    emit viewportChanged();
 }
 
 void ViewerWidget::clearSelection()
@@ -23,9 +30,9 @@ void ViewerWidget::clearSelection()
     m_imageLabel->clearSelection();
 }
 
-void ViewerWidget::setCharRects(const QVector<QRectF>& charRects)
+void ViewerWidget::setTextLayer(const QSharedPointer<const TextLayer>& layer, qreal zoomFactor)
 {
-    m_imageLabel->setCharRects(charRects);
+    m_imageLabel->setTextLayer(layer, zoomFactor);
 }
 
 bool ViewerWidget::hasSelection() const
@@ -35,12 +42,67 @@ bool ViewerWidget::hasSelection() const
 
 void ViewerWidget::setPageImage(const QImage &image)
 {
-    if (image.isNull()) {
-        m_imageLabel->clear();
-        return;
+    m_isTiled = false;
+    m_imageLabel->clearTiles();
+    m_imageLabel->clearPreview();
+    m_imageLabel->setPageImage(image);
+    if (!image.isNull()) {
+        m_imageLabel->resize(image.size());
+    }
+}
+
+void ViewerWidget::setColorFilter(const ColorFilter &filter)
+{
+    m_imageLabel->setColorFilter(filter);
+}
+
+void ViewerWidget::setTiledPage(const QSize &pageSize)
+{
+    m_isTiled = true;
+    m_imageLabel->setPageImage(QImage());
+    m_imageLabel->clearTiles();
+    m_imageLabel->clearPreview();
+    m_imageLabel->resize(pageSize);
+}
+
+void ViewerWidget::setPreviewImage(const QImage &image, const QSize &pageSize)
+{
+    m_imageLabel->setPageImage(QImage());
+    m_imageLabel->setPreview(image);
+    m_imageLabel->resize(pageSize);
+}
+
+bool ViewerWidget::isTiled() const
+{
+    return m_isTiled;
+}
+
+QSize ViewerWidget::pageSize() const
+{
+    return m_imageLabel->size();
+}
+
+QRect ViewerWidget::visiblePageRect() const
+{
+    const QRect viewportRect(-m_imageLabel->pos(), viewport()->size());
+    return viewportRect & m_imageLabel->rect();
+}
+
+void ViewerWidget::setTile(const QRect &rect, const QImage &image)
+{
+    if (m_isTiled) {
+        m_imageLabel->setTile(rect, image);
     }
-    m_imageLabel->setPixmap(QPixmap::fromImage(image));
-    m_imageLabel->resize(image.size());
+}
+
+bool ViewerWidget::hasTile(const QRect &rect) const
+{
+    return m_imageLabel->hasTile(rect);
+}
+
+void ViewerWidget::pruneTiles(const QRect &keepRect)
+{
+    m_imageLabel->pruneTiles(keepRect);
 }
 
 void ViewerWidget::scrollToTop()
@@ -57,7 +119,7 @@ void ViewerWidget::scrollToBottom()
     }
 }
 
-void ViewerWidget::setHighlights(const QVector<QRectF>& allRects, const QRectF& currentRect, qreal zoomFactor)
+void ViewerWidget::setHighlights(const QVector<QRectF>& allRects, const QRectF& currentRect, qreal zoomFactor, bool ensureCurrentVisible)
 {
     QVector<QRectF> scaledAllRects;
     scaledAllRects.reserve(allRects.size());
@@ -76,7 +138,9 @@ void ViewerWidget::setHighlights(const QVector<QRectF>& allRects, const QRectF&
         );
 
     m_imageLabel->setSearchHighlights(scaledAllRects, scaledCurrentRect);
-    ensureVisible(scaledCurrentRect.center().x(), scaledCurrentRect.center().y(), 100, 100);
+    if (ensureCurrentVisible) {
+        ensureVisible(scaledCurrentRect.center().x(), scaledCurrentRect.center().y(), 100, 100);
+    }
 }
 
 void ViewerWidget::clearHighlight()
@@ -4,8 +4,12 @@
 #include <QImage>
 #include <QVector>
 #include <QRectF>
+#include <QSharedPointer>
+
+#include "colorfilter.h"
 
 class SelectionLabel;
+struct TextLayer;
 
 class ViewerWidget : public QScrollArea
 {
@@ -13,18 +17,39 @@ class ViewerWidget : public QScrollArea
 public:
     explicit ViewerWidget(QWidget *parent = nullptr);
     void setPageImage(const QImage &image);
+    void setColorFilter(const ColorFilter &filter);
+
+    // Shows a bitmap rendered at another zoom, stretched to the new page size, until
+    // the crisp render arrives through setPageImage() or setTile().
+    void setPreviewImage(const QImage &image, const QSize &pageSize);
+
+    // Tiled mode: the page is laid out at full size but only the tiles handed in
+    // through setTile() are painted.
+    void setTiledPage(const QSize &pageSize);
+    bool isTiled() const;
+    QSize pageSize() const;
+    QRect visiblePageRect() const;
+    void setTile(const QRect &rect, const QImage &image);
+    bool hasTile(const QRect &rect) const;
+    void pruneTiles(const QRect &keepRect);
+
     void clearSelection();
-    void setCharRects(const QVector<QRectF>& charRects);
+    void setTextLayer(const QSharedPointer<const TextLayer>& layer, qreal zoomFactor);
     void scrollToTop();
     void scrollToBottom();
     bool hasSelection() const;
 
-    void setHighlights(const QVector<QRectF>& allRects, const QRectF& currentRect, qreal zoomFactor);
+    void setHighlights(const QVector<QRectF>& allRects, const QRectF& currentRect, qreal zoomFactor, bool ensureCurrentVisible = true);
     void clearHighlight();
 
 signals:
-    void textSelected(const QRect& rect);
+    void textSelected(const QRect& rect, int firstGlyph, int lastGlyph);
+    void viewportChanged();
+
+protected:
+    void resizeEvent(QResizeEvent *event) override;
 
 private:
     SelectionLabel *m_imageLabel;
+    bool m_isTiled;
 };